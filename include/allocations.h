@@ -0,0 +1,93 @@
+#ifndef ALLOCATIONS_H
+#define ALLOCATIONS_H
+
+#include <cstddef>
+#include <string>
+#include <catch.hpp>
+
+/** Heap allocation accounting
+ *
+ * Replacements for the global operator new and delete count every call made by
+ * the current thread. They live in the `allocations` library: only executables
+ * linked against it get them, and every allocation they make pays for the
+ * count. Counters are thread-local, so counting takes no lock and threads do
+ * not see each other's allocations.
+ *
+ * Typical use, in a test:
+ *     CHECK_THAT(count_allocations([&] { fight(wilhelm, Weapon::Stick); }),
+ *                Allocates(3));
+ */
+
+struct AllocationStats {
+    std::size_t     allocations;
+    std::size_t     deallocations;
+    std::size_t     bytes;          // total requested by allocations, frees not deducted
+};
+
+// Totals for the calling thread since it started.
+AllocationStats thread_allocations();
+
+// Counts allocations made by the calling thread while it is alive.
+class AllocationScope {
+    AllocationStats start_;
+public:
+    AllocationScope() : start_(thread_allocations()) {}
+
+    AllocationStats stats() const
+    {
+        const auto now = thread_allocations();
+        return { now.allocations - start_.allocations,
+                 now.deallocations - start_.deallocations,
+                 now.bytes - start_.bytes };
+    }
+};
+
+template <typename Func>
+AllocationStats count_allocations(Func && func)
+{
+    const AllocationScope scope;
+    func();
+    return scope.stats();
+}
+
+// ===========================================================================
+// Catch2 integration
+
+namespace Catch {
+    template <> struct StringMaker<AllocationStats> {
+        static std::string convert(const AllocationStats & stats)
+        {
+            return std::to_string(stats.allocations) + " allocations of "
+                 + std::to_string(stats.bytes) + " bytes, "
+                 + std::to_string(stats.deallocations) + " deallocations";
+        }
+    };
+}
+
+class AllocationCountMatcher : public Catch::MatcherBase<AllocationStats> {
+    std::size_t     min_;
+    std::size_t     max_;
+public:
+    AllocationCountMatcher(std::size_t min, std::size_t max) : min_(min), max_(max) {}
+
+    bool match(const AllocationStats & stats) const override
+    {
+        return min_ <= stats.allocations && stats.allocations <= max_;
+    }
+
+    std::string describe() const override
+    {
+        if (max_ == 0)
+            return "allocates nothing";
+        const auto times = std::to_string(max_) + (max_ == 1 ? " time" : " times");
+        if (min_ == max_)
+            return "allocates exactly " + times;
+        return "allocates at most " + times;
+    }
+};
+
+inline AllocationCountMatcher AllocatesNothing() { return { 0, 0 }; }
+inline AllocationCountMatcher Allocates(std::size_t count) { return { count, count }; }
+inline AllocationCountMatcher AllocatesAtMost(std::size_t count) { return { 0, count }; }
+
+#endif
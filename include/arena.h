@@ -0,0 +1,100 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/** Encounter-scoped memory
+ *
+ * Everything spawned in an arena is carved out of the same few blocks of
+ * memory, one after the other. Nothing is freed individually: reset() runs
+ * the destructors and rewinds the whole arena at once.
+ *
+ * The arena is a std::pmr::memory_resource, so allocator-aware types such as
+ * std::pmr::string can put their own allocations in it as well.
+ *
+ * The first block of every arena comes from a pool owned by the thread,
+ * and goes back to it when the arena dies. After a warm-up, running encounter
+ * after encounter does not touch the heap at all. An arena must therefore be
+ * destroyed by the thread that created it.
+ */
+class EncounterArena {
+public:
+    static constexpr std::size_t block_size = std::size_t(64) << 10;
+
+private:
+    struct BlockPool {
+        std::vector<std::unique_ptr<std::byte[]>>   blocks;
+        std::pmr::unsynchronized_pool_resource      overflow;   // for arenas that outgrow their block
+    };
+
+    static BlockPool & thread_pool()
+    {
+        thread_local BlockPool pool;
+        return pool;
+    }
+
+    struct Object {
+        void *  address;
+        void    (*destroy)(void *);
+    };
+
+    std::unique_ptr<std::byte[]>            block_;
+    std::pmr::monotonic_buffer_resource     resource_;
+    std::pmr::vector<Object>                objects_;
+
+    static std::unique_ptr<std::byte[]> acquire_block()
+    {
+        auto & pool = thread_pool();
+        if (pool.blocks.empty())
+            return std::make_unique<std::byte[]>(block_size);
+        auto block = std::move(pool.blocks.back());
+        pool.blocks.pop_back();
+        return block;
+    }
+
+public:
+    EncounterArena()
+        : block_(acquire_block()),
+          resource_(block_.get(), block_size, &thread_pool().overflow),
+          objects_(&resource_) {}
+
+    ~EncounterArena()
+    {
+        reset();
+        thread_pool().blocks.push_back(std::move(block_));
+    }
+
+    EncounterArena(const EncounterArena &) = delete;
+    EncounterArena & operator=(const EncounterArena &) = delete;
+
+    std::pmr::memory_resource * resource() { return &resource_; }
+    std::size_t size() const { return objects_.size(); }
+
+    // Constructs an object in the arena. It lives until reset().
+    template <typename T, typename... Args>
+    T & spawn(Args &&... args)
+    {
+        void * memory = resource_.allocate(sizeof(T), alignof(T));
+        auto object = ::new (memory) T(std::forward<Args>(args)...);
+        if constexpr (!std::is_trivially_destructible_v<T>)
+            objects_.push_back({ object, [](void * ptr) { static_cast<T *>(ptr)->~T(); } });
+        return *object;
+    }
+
+    // Destroys everything, in reverse order of creation, and releases memory in one go.
+    void reset()
+    {
+        for (auto it = objects_.rbegin(); it != objects_.rend(); ++it)
+            it->destroy(it->address);
+        std::pmr::vector<Object>(&resource_).swap(objects_);   // drop storage before releasing it
+        resource_.release();
+    }
+};
+
+#endif
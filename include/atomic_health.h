@@ -0,0 +1,143 @@
+#ifndef ATOMIC_HEALTH_H
+#define ATOMIC_HEALTH_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include "health.h"
+
+/** Thread-safe health points
+ *
+ * HealthPoints is a plain value, which is what we want most of the time.
+ * When many threads hit the same monster at once, we need a shared version
+ * whose updates cannot be lost and whose death is reported exactly once.
+ */
+
+// What a single subtraction actually did.
+// `applied` is the damage that was removed once clamped at zero, and `killed`
+// is true for the one and only subtraction that brought health down to zero.
+struct DamageOutcome {
+    HealthPoints    applied;
+    bool            killed;
+};
+
+class AtomicHealthPoints {
+    std::atomic<int>    value_;
+public:
+    explicit AtomicHealthPoints(HealthPoints hp) : value_(hp.value) {}
+
+    HealthPoints load() const { return { value_.load(std::memory_order_acquire) }; }
+    explicit operator bool() const { return bool(load()); }
+
+    // Clamp-at-zero subtraction. Gives up after `retries` failed compare-exchange
+    // and returns false, so callers can do something smarter than spinning.
+    bool try_subtract(HealthPoints damage, DamageOutcome & outcome, int retries)
+    {
+        int current = value_.load(std::memory_order_relaxed);
+        for (;;) {
+            if (current <= 0) {
+                outcome = { HealthPoints{0}, false };
+                return true;
+            }
+            const int next = std::max(0, current - damage.value);
+            if (value_.compare_exchange_weak(current, next,
+                                             std::memory_order_acq_rel, std::memory_order_relaxed)) {
+                outcome = { HealthPoints{current - next}, next == 0 };
+                return true;
+            }
+            if (retries-- == 0)
+                return false;
+        }
+    }
+
+    DamageOutcome subtract(HealthPoints damage)
+    {
+        DamageOutcome outcome;
+        while (!try_subtract(damage, outcome, 64)) {}
+        return outcome;
+    }
+};
+
+/** Health points for monsters under heavy contention.
+ *
+ * Hits first try a short compare-exchange on the health itself. When that keeps
+ * failing because too many threads fight over the same cache line, the damage
+ * is parked in a per-thread shard instead.
+ *
+ * Parked damage is folded back into the health by the next hit that finds some
+ * waiting, whichever path it took. Whoever folds keeps going until nothing is
+ * left, so once all hits have returned, no damage is still parked and the kill
+ * has been reported to one of them. settle() does the same without hitting.
+ *
+ * CasRetries is how many failed compare-exchange it takes to park the damage.
+ * A negative value parks every hit, which is only useful to test the folding.
+ */
+template <std::size_t Shards = 16, int CasRetries = 4>
+class ContendedHealthPoints {
+    struct alignas(64) Shard { std::atomic<int> pending{0}; };
+
+    AtomicHealthPoints          health_;
+    std::array<Shard, Shards>   shards_;
+    std::atomic<int>            parked_{0};         // sum of all shards, may briefly lag behind them
+    std::atomic<bool>           folding_{false};
+
+    static std::size_t shard_index()
+    {
+        static std::atomic<std::size_t> next{0};
+        thread_local const std::size_t index = next.fetch_add(1, std::memory_order_relaxed) % Shards;
+        return index;
+    }
+
+    static DamageOutcome combine(DamageOutcome lhs, DamageOutcome rhs)
+    {
+        return { lhs.applied + rhs.applied, lhs.killed || rhs.killed };
+    }
+
+    // Folds parked damage until none is left or another thread took over.
+    // The check after releasing the flag closes the window where damage is
+    // parked while the previous folder was finishing.
+    DamageOutcome fold()
+    {
+        DamageOutcome outcome{ HealthPoints{0}, false };
+        while (parked_.load() != 0 && !folding_.exchange(true)) {
+            int pending = 0;
+            for (auto & shard : shards_)
+                pending += shard.pending.exchange(0);
+            parked_.fetch_sub(pending);
+            if (pending != 0)
+                outcome = combine(outcome, health_.subtract(HealthPoints{pending}));
+            folding_.store(false);
+        }
+        return outcome;
+    }
+
+public:
+    explicit ContendedHealthPoints(HealthPoints hp) : health_(hp) {}
+
+    HealthPoints load() const { return health_.load(); }
+    explicit operator bool() const { return bool(health_); }
+
+    DamageOutcome subtract(HealthPoints damage)
+    {
+        DamageOutcome outcome;
+        if (CasRetries < 0 || !health_.try_subtract(damage, outcome, CasRetries)) {
+            shards_[shard_index()].pending.fetch_add(damage.value);
+            parked_.fetch_add(damage.value);
+            outcome = { HealthPoints{0}, false };
+        }
+        return combine(outcome, fold());
+    }
+
+    // Folds whatever is parked. Outcomes returned here count just like the ones
+    // from subtract(), including the kill.
+    DamageOutcome settle()
+    {
+        DamageOutcome outcome{ HealthPoints{0}, false };
+        while (parked_.load() != 0)
+            outcome = combine(outcome, fold());
+        return outcome;
+    }
+};
+
+#endif
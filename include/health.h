@@ -18,5 +18,118 @@ template <typename Scalar> constexpr HealthPoints operator/(HealthPoints lhs, Sc
 constexpr HealthPoints max(HealthPoints lhs, HealthPoints rhs) { return { std::max(lhs.value, rhs.value) }; };
 constexpr HealthPoints min(HealthPoints lhs, HealthPoints rhs) { return { std::min(lhs.value, rhs.value) }; };
 
+// ===========================================================================
+// Damage modifiers
+//
+// Armor, critical hits, resistances, damage over time... are small functions
+// from damage to damage. Chaining them with | builds a single type describing the whole chain,
+// for instance armor(5) | crit(2, 25) | resist<Wolf>(), whose call operator
+// the compiler inlines into one kernel. No virtual call, no intermediate object.
+
+// What the dice said for this hit, from 0 to 99, and which tick of a lasting
+// effect is being applied: 0 for the hit itself, then 1, 2... for the ticks
+// after it, which come with no damage of their own. Passed in so modifiers stay pure.
+struct HitRoll {
+    int     percent;
+    int     tick = 0;
+};
+
+// Base of all modifiers, only there so that operator| knows what it can chain.
+template <typename Derived> struct DamageModifier {
+    constexpr const Derived & self() const { return static_cast<const Derived &>(*this); }
+};
+
+template <typename First, typename Second>
+struct ModifierChain : DamageModifier<ModifierChain<First, Second>> {
+    First   first;
+    Second  second;
+
+    constexpr ModifierChain(First lhs, Second rhs) : first(lhs), second(rhs) {}
+    constexpr HealthPoints operator()(HealthPoints damage, HitRoll roll = {0}) const
+    {
+        return second(first(damage, roll), roll);
+    }
+};
+
+template <typename First, typename Second>
+constexpr ModifierChain<First, Second> operator|(const DamageModifier<First> & lhs, const DamageModifier<Second> & rhs)
+{
+    return { lhs.self(), rhs.self() };
+}
+
+struct Armor : DamageModifier<Armor> {
+    int     points;
+
+    constexpr explicit Armor(int value) : points(value) {}
+    constexpr HealthPoints operator()(HealthPoints damage, HitRoll = {0}) const
+    {
+        return max(HealthPoints{0}, damage - HealthPoints{points});
+    }
+};
+
+struct Critical : DamageModifier<Critical> {
+    int     multiplier;
+    int     chance;             // percent
+
+    constexpr Critical(int times, int percent) : multiplier(times), chance(percent) {}
+    constexpr HealthPoints operator()(HealthPoints damage, HitRoll roll = {0}) const
+    {
+        return roll.percent < chance ? damage * multiplier : damage;
+    }
+};
+
+// Damage over time, such as a poisoned blade: per_tick more damage on the hit
+// and on each tick after it, for ticks ticks in total.
+struct DamageOverTime : DamageModifier<DamageOverTime> {
+    int     per_tick;
+    int     ticks;
+
+    constexpr DamageOverTime(int points, int count) : per_tick(points), ticks(count) {}
+    constexpr HealthPoints operator()(HealthPoints damage, HitRoll roll = {0}) const
+    {
+        return roll.tick < ticks ? damage + HealthPoints{per_tick} : damage;
+    }
+};
+
+// How much of the damage a monster type actually takes, in percent.
+// Specialize it next to the monster: template <> struct Resistance<Wolf> {...};
+// Resistances already built into the monster's hit() must not be repeated here.
+template <typename Monster> struct Resistance { static constexpr int percent = 100; };
+
+template <typename Monster>
+struct Resist : DamageModifier<Resist<Monster>> {
+    constexpr HealthPoints operator()(HealthPoints damage, HitRoll = {0}) const
+    {
+        return damage * Resistance<Monster>::percent / 100;
+    }
+};
+
+constexpr Armor armor(int points) { return Armor(points); }
+constexpr Critical crit(int multiplier, int chance) { return Critical(multiplier, chance); }
+constexpr DamageOverTime dot(int per_tick, int ticks) { return DamageOverTime(per_tick, ticks); }
+template <typename Monster> constexpr Resist<Monster> resist() { return {}; }
+
+// Batch form over a column of health points: everyone takes the same hit.
+// The damage is computed once, the loop is a plain clamped subtraction.
+template <typename Modifier>
+constexpr void apply_damage(const DamageModifier<Modifier> & modifier,
+                            HealthPoints * first, HealthPoints * last,
+                            HealthPoints damage, HitRoll roll = {0})
+{
+    const auto taken = modifier.self()(damage, roll);
+    for (; first != last; ++first)
+        *first = max(HealthPoints{0}, *first - taken);
+}
+
+// Same, with one roll per monster.
+template <typename Modifier>
+constexpr void apply_damage(const DamageModifier<Modifier> & modifier,
+                            HealthPoints * first, HealthPoints * last,
+                            HealthPoints damage, const HitRoll * rolls)
+{
+    for (; first != last; ++first, ++rolls)
+        *first = max(HealthPoints{0}, *first - modifier.self()(damage, *rolls));
+}
+
 
 #endif
\ No newline at end of file
@@ -0,0 +1,225 @@
+#ifndef MEMO_CACHE_H
+#define MEMO_CACHE_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+/** Concurrent memoization of pure functions
+ *
+ * A fixed-size, set-associative cache: a key hashes to one small set of slots,
+ * and is looked for in that set only. When the set is full, CLOCK picks the
+ * victim: every hit marks its slot as referenced, and the eviction hand skips
+ * (and clears) referenced slots until it finds one that was not used lately.
+ *
+ * Neither reads nor writes ever wait. Each slot is a seqlock: readers copy the
+ * entry and retry-by-missing if a writer touched it meanwhile, writers simply
+ * skip the insert if another writer holds the slot. It is a cache after all.
+ *
+ * Keys and values are copied as raw words, so both must be trivially copyable.
+ */
+template <typename Key, typename Value,
+          typename Hash = std::hash<Key>, typename Equal = std::equal_to<Key>,
+          std::size_t Sets = 256, std::size_t Ways = 8>
+class MemoCache {
+    static_assert(std::is_trivially_copyable_v<Key>, "MemoCache keys must be trivially copyable");
+    static_assert(std::is_trivially_copyable_v<Value>, "MemoCache values must be trivially copyable");
+    static_assert((Sets & (Sets - 1)) == 0, "Sets must be a power of two");
+
+    struct Entry {
+        Key     key;
+        Value   value;
+    };
+    static constexpr std::size_t words = (sizeof(Entry) + sizeof(std::uint64_t) - 1) / sizeof(std::uint64_t);
+
+    struct Slot {
+        std::atomic<std::uint32_t>                  version{0};     // 0: empty, odd: being written
+        std::atomic<bool>                           referenced{false};
+        std::array<std::atomic<std::uint64_t>, words> data{};
+    };
+
+    struct alignas(64) Set {
+        std::array<Slot, Ways>          slots;
+        std::atomic<std::uint32_t>      hand{0};
+        std::atomic<std::uint64_t>      hits{0};
+        std::atomic<std::uint64_t>      misses{0};
+    };
+
+    std::array<Set, Sets>   sets_;
+    Hash                    hash_;
+    Equal                   equal_;
+
+    Set & set_for(const Key & key) { return sets_[hash_(key) & (Sets - 1)]; }
+
+    static bool read(const Slot & slot, Entry & entry)
+    {
+        const auto before = slot.version.load(std::memory_order_acquire);
+        if (before == 0 || (before & 1))
+            return false;
+        std::uint64_t raw[words];
+        for (std::size_t i = 0; i < words; ++i)
+            raw[i] = slot.data[i].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.version.load(std::memory_order_relaxed) != before)
+            return false;
+        std::memcpy(&entry, raw, sizeof(Entry));
+        return true;
+    }
+
+    static bool write(Slot & slot, const Entry & entry)
+    {
+        auto version = slot.version.load(std::memory_order_relaxed);
+        if ((version & 1) || !slot.version.compare_exchange_strong(version, version + 1, std::memory_order_acquire))
+            return false;
+        std::atomic_thread_fence(std::memory_order_release);
+
+        std::uint64_t raw[words] = {};
+        std::memcpy(raw, &entry, sizeof(Entry));
+        for (std::size_t i = 0; i < words; ++i)
+            slot.data[i].store(raw[i], std::memory_order_relaxed);
+        slot.referenced.store(false, std::memory_order_relaxed);
+        slot.version.store(version + 2, std::memory_order_release);
+        return true;
+    }
+
+    // CLOCK: give referenced slots a second chance, take the first one that is not.
+    static Slot & victim(Set & set)
+    {
+        for (;;) {
+            auto & slot = set.slots[set.hand.fetch_add(1, std::memory_order_relaxed) % Ways];
+            if (slot.version.load(std::memory_order_relaxed) == 0
+                || !slot.referenced.exchange(false, std::memory_order_relaxed))
+                return slot;
+        }
+    }
+
+public:
+    struct Stats {
+        std::uint64_t   hits;
+        std::uint64_t   misses;
+
+        double hit_rate() const { return hits + misses ? double(hits) / double(hits + misses) : 0.0; }
+    };
+
+    static constexpr std::size_t capacity = Sets * Ways;
+
+    bool find(const Key & key, Value & value)
+    {
+        auto & set = set_for(key);
+        Entry entry;
+        for (auto & slot : set.slots) {
+            if (read(slot, entry) && equal_(entry.key, key)) {
+                if (!slot.referenced.load(std::memory_order_relaxed))
+                    slot.referenced.store(true, std::memory_order_relaxed);
+                set.hits.fetch_add(1, std::memory_order_relaxed);
+                value = entry.value;
+                return true;
+            }
+        }
+        set.misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    // Best effort: does nothing if another thread is writing the chosen slot.
+    void insert(const Key & key, const Value & value)
+    {
+        write(victim(set_for(key)), Entry{ key, value });
+    }
+
+    template <typename Compute>
+    Value get_or_compute(const Key & key, Compute && compute)
+    {
+        Value value;
+        if (find(key, value))
+            return value;
+        value = std::forward<Compute>(compute)();
+        insert(key, value);
+        return value;
+    }
+
+    Stats stats() const
+    {
+        Stats total{ 0, 0 };
+        for (const auto & set : sets_) {
+            total.hits += set.hits.load(std::memory_order_relaxed);
+            total.misses += set.misses.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+};
+
+/** What of a monster decides how its fights end
+ *
+ * By default, all of it: the monster itself is the key, and needs operator==
+ * and a std::hash specialization. Specialize it next to monsters that carry
+ * more than that, such as a name:
+ *   - key(monster) returns only what fights depend on, trivially copyable,
+ *     with operator== and std::hash,
+ *   - restore(result, monster) puts the rest of the caller's monster back into
+ *     a result that may have been computed for another one.
+ */
+template <typename Monster>
+struct FightKey {
+    static Monster key(const Monster & monster) { return monster; }
+    template <typename Result> static void restore(Result &, const Monster &) {}
+};
+
+/** Memoized pure fight
+ *
+ * Wraps any pure fight(monster, weapon, attempts) so that identical queries are
+ * only computed once. Queries are keyed on FightKey<Monster>::key(monster).
+ * Monsters and the result of the fight must be trivially copyable.
+ */
+template <typename Monster, typename Weapon, typename Fight>
+class MemoizedFight {
+public:
+    using Key = decltype(FightKey<Monster>::key(std::declval<const Monster &>()));
+
+    struct Query {
+        Key         key;
+        Weapon      weapon;
+        int         attempts;
+
+        friend bool operator==(const Query & lhs, const Query & rhs)
+        {
+            return lhs.key == rhs.key && lhs.weapon == rhs.weapon && lhs.attempts == rhs.attempts;
+        }
+    };
+
+    struct QueryHash {
+        std::size_t operator()(const Query & query) const
+        {
+            auto hash = std::hash<Key>{}(query.key);
+            hash ^= std::hash<Weapon>{}(query.weapon) + 0x9e3779b9u + (hash << 6) + (hash >> 2);
+            hash ^= std::hash<int>{}(query.attempts) + 0x9e3779b9u + (hash << 6) + (hash >> 2);
+            return hash;
+        }
+    };
+
+    using Result = std::invoke_result_t<Fight, Monster, Weapon, int>;
+    using Cache = MemoCache<Query, Result, QueryHash>;
+
+private:
+    Fight   fight_;
+    Cache   cache_;
+
+public:
+    explicit MemoizedFight(Fight fight) : fight_(std::move(fight)) {}
+
+    Result operator()(Monster monster, Weapon weapon, int attempts = 5)
+    {
+        auto result = cache_.get_or_compute(Query{ FightKey<Monster>::key(monster), weapon, attempts },
+                                            [&] { return fight_(monster, weapon, attempts); });
+        FightKey<Monster>::restore(result, monster);
+        return result;
+    }
+
+    typename Cache::Stats stats() const { return cache_.stats(); }
+};
+
+#endif
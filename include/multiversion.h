@@ -0,0 +1,55 @@
+#ifndef MULTIVERSION_H
+#define MULTIVERSION_H
+
+/** Building a kernel for several instruction sets
+ *
+ * Write the kernel once as a POLY_FORCE_INLINE function, then wrap it in one
+ * function per ISA level marked with POLY_TARGET_*. Each wrapper gets its own
+ * copy of the kernel, compiled for its instruction set. detect_isa() tells at
+ * runtime which of them the CPU can run.
+ *
+ * On compilers or architectures where this is not supported, every level
+ * compiles to the baseline and detect_isa() always says Baseline.
+ */
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define POLY_MULTIVERSION 1
+#define POLY_FORCE_INLINE __attribute__((always_inline)) inline
+#define POLY_TARGET_SSE42 __attribute__((target("sse4.2,popcnt")))
+#define POLY_TARGET_AVX2 __attribute__((target("avx2,bmi,bmi2,fma")))
+#define POLY_TARGET_AVX512 __attribute__((target("avx512f,avx512bw,avx512dq,avx512vl")))
+#else
+#define POLY_FORCE_INLINE inline
+#define POLY_TARGET_SSE42
+#define POLY_TARGET_AVX2
+#define POLY_TARGET_AVX512
+#endif
+
+enum class Isa { Baseline, Sse42, Avx2, Avx512 };
+
+inline Isa detect_isa()
+{
+#ifdef POLY_MULTIVERSION
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")
+        && __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512vl"))
+        return Isa::Avx512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2") && __builtin_cpu_supports("fma"))
+        return Isa::Avx2;
+    if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt"))
+        return Isa::Sse42;
+#endif
+    return Isa::Baseline;
+}
+
+constexpr const char * isa_name(Isa isa)
+{
+    switch (isa) {
+    case Isa::Sse42:    return "SSE4.2";
+    case Isa::Avx2:     return "AVX2";
+    case Isa::Avx512:   return "AVX-512";
+    default:            return "baseline";
+    }
+}
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <optional>
+#include <thread>
+#include <utility>
+
+/** Bounded single-producer single-consumer queue
+ *
+ * One thread pushes, one thread pops, and neither ever takes a lock.
+ * The queue has a fixed capacity: when it is full, push() waits for the
+ * consumer to catch up, which is how backpressure flows up a pipeline.
+ *
+ * The producer calls close() once it is done. pop() then drains what is
+ * left and returns an empty optional.
+ */
+template <typename T, std::size_t Capacity>
+class SpscQueue {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+    // Producer and consumer each write their own index, keep them on separate cache lines.
+    alignas(64) std::atomic<std::size_t>    head_{0};       // next slot to pop
+    alignas(64) std::atomic<std::size_t>    tail_{0};       // next slot to push
+    alignas(64) std::atomic<bool>           closed_{false};
+    std::array<T, Capacity>                 slots_;
+
+public:
+    bool try_push(T & value)
+    {
+        const auto tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) == Capacity)
+            return false;
+        slots_[tail % Capacity] = std::move(value);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Waits while the queue is full. Returns how many times it had to wait.
+    std::size_t push(T value)
+    {
+        std::size_t stalls = 0;
+        while (!try_push(value)) {
+            ++stalls;
+            std::this_thread::yield();
+        }
+        return stalls;
+    }
+
+    bool try_pop(T & value)
+    {
+        const auto head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire))
+            return false;
+        value = std::move(slots_[head % Capacity]);
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Waits for a value, or returns nothing once the queue is closed and drained.
+    std::optional<T> pop()
+    {
+        T value;
+        for (;;) {
+            if (try_pop(value))
+                return value;
+            if (closed_.load(std::memory_order_acquire)) {
+                if (try_pop(value))     // pushed right before closing
+                    return value;
+                return std::nullopt;
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    void close() { closed_.store(true, std::memory_order_release); }
+
+    // True once the producer closed the queue and everything was popped.
+    bool finished() const
+    {
+        return closed_.load(std::memory_order_acquire)
+            && head_.load(std::memory_order_relaxed) == tail_.load(std::memory_order_acquire);
+    }
+};
+
+#endif
@@ -0,0 +1,191 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/** Hierarchical timing wheel
+ *
+ * Schedules payloads to fire after a number of ticks. Insert and cancel are
+ * O(1): a timer is just linked into a slot. The first level has one slot per
+ * tick; each further level has one slot per full turn of the level below.
+ * When a lower level wraps around, the matching slot of the level above is
+ * cascaded down. With the defaults (4 levels of 64 slots), timers up to 2^24
+ * ticks away are placed directly. Farther ones are parked in the last level
+ * and cascade until they are close enough.
+ *
+ * Time only moves when advance() is called, so the clock is fully simulated
+ * and runs are deterministic. All timers due on the same tick fire together,
+ * as one batch.
+ */
+template <typename Payload, unsigned LevelBits = 6, unsigned Levels = 4>
+class TimerWheel {
+public:
+    using Tick = std::uint64_t;
+
+    // Identifies a scheduled timer. Stays safe to cancel after the timer fired.
+    struct Handle {
+        std::uint32_t   index;
+        std::uint32_t   generation;
+    };
+
+private:
+    static constexpr std::uint32_t nil = ~std::uint32_t(0);
+    static constexpr std::size_t slots = std::size_t(1) << LevelBits;
+    static constexpr Tick slot_mask = slots - 1;
+    static constexpr Tick horizon = Tick(1) << (LevelBits * Levels);
+
+    struct Node {
+        Payload         payload;
+        Tick            expiry = 0;
+        std::uint32_t   prev = nil;
+        std::uint32_t   next = nil;
+        std::uint32_t   bucket = nil;       // nil when the node is free
+        std::uint32_t   generation = 0;
+    };
+
+    std::vector<Node>                           nodes_;
+    std::vector<std::uint32_t>                  free_;
+    std::array<std::uint32_t, slots * Levels>   heads_;
+    std::array<std::uint32_t, slots * Levels>   tails_;
+    Tick                                        now_ = 0;
+    std::size_t                                 size_ = 0;
+    std::vector<Payload>                        batch_;
+
+    std::uint32_t bucket_for(Tick expiry) const
+    {
+        const auto delay = expiry - now_;
+        unsigned level = 0;
+        while (level + 1 < Levels && delay >= (Tick(1) << (LevelBits * (level + 1))))
+            ++level;
+        // Too far for the wheel: park it in the last slot it can reach, it will be cascaded again.
+        const auto target = delay < horizon ? expiry : now_ + horizon - 1;
+        return std::uint32_t(level * slots + ((target >> (LevelBits * level)) & slot_mask));
+    }
+
+    void link(std::uint32_t index)
+    {
+        auto & node = nodes_[index];
+        node.bucket = bucket_for(node.expiry);
+        node.prev = tails_[node.bucket];
+        node.next = nil;
+        if (node.prev == nil)
+            heads_[node.bucket] = index;
+        else
+            nodes_[node.prev].next = index;
+        tails_[node.bucket] = index;
+    }
+
+    void unlink(std::uint32_t index)
+    {
+        auto & node = nodes_[index];
+        (node.prev == nil ? heads_[node.bucket] : nodes_[node.prev].next) = node.next;
+        (node.next == nil ? tails_[node.bucket] : nodes_[node.next].prev) = node.prev;
+    }
+
+    void release(std::uint32_t index)
+    {
+        auto & node = nodes_[index];
+        node.bucket = nil;
+        ++node.generation;
+        free_.push_back(index);
+        --size_;
+    }
+
+    // Detaches a whole slot, returns the first node of its list.
+    std::uint32_t take(std::uint32_t bucket)
+    {
+        const auto first = heads_[bucket];
+        heads_[bucket] = tails_[bucket] = nil;
+        return first;
+    }
+
+    void cascade(unsigned level)
+    {
+        for (auto index = take(std::uint32_t(level * slots + ((now_ >> (LevelBits * level)) & slot_mask)));
+             index != nil;) {
+            const auto next = nodes_[index].next;
+            link(index);
+            index = next;
+        }
+    }
+
+public:
+    TimerWheel()
+    {
+        heads_.fill(nil);
+        tails_.fill(nil);
+    }
+
+    Tick now() const { return now_; }
+    std::size_t size() const { return size_; }
+
+    // Fires `delay` ticks from now. A delay of 0 is treated as 1: the current tick is done.
+    Handle schedule(Tick delay, Payload payload)
+    {
+        std::uint32_t index;
+        if (free_.empty()) {
+            index = std::uint32_t(nodes_.size());
+            nodes_.emplace_back();
+        } else {
+            index = free_.back();
+            free_.pop_back();
+        }
+        auto & node = nodes_[index];
+        node.payload = std::move(payload);
+        node.expiry = now_ + (delay ? delay : 1);
+        link(index);
+        ++size_;
+        return { index, node.generation };
+    }
+
+    // Returns false if the timer already fired or was cancelled.
+    bool cancel(Handle handle)
+    {
+        if (handle.index >= nodes_.size())
+            return false;
+        const auto & node = nodes_[handle.index];
+        if (node.generation != handle.generation || node.bucket == nil)
+            return false;
+        unlink(handle.index);
+        release(handle.index);
+        return true;
+    }
+
+    /** Moves the clock forward, calling on_fire(tick, batch) once for each tick
+     * that has due timers. batch is a std::vector<Payload>&, valid during the call.
+     * on_fire may schedule and cancel timers, but must not call advance().
+     */
+    template <typename OnFire>
+    void advance(Tick ticks, OnFire && on_fire)
+    {
+        const auto end = now_ + ticks;
+        while (now_ < end) {
+            if (size_ == 0) {       // nothing can fire, skip straight to the end
+                now_ = end;
+                break;
+            }
+            ++now_;
+            for (unsigned level = Levels - 1; level > 0; --level) {
+                if ((now_ & ((Tick(1) << (LevelBits * level)) - 1)) == 0)
+                    cascade(level);
+            }
+
+            for (auto index = take(std::uint32_t(now_ & slot_mask)); index != nil;) {
+                const auto next = nodes_[index].next;
+                batch_.push_back(std::move(nodes_[index].payload));
+                release(index);
+                index = next;
+            }
+            if (!batch_.empty()) {
+                on_fire(now_, batch_);
+                batch_.clear();
+            }
+        }
+    }
+};
+
+#endif
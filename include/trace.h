@@ -0,0 +1,122 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define POLY_TRACE_TSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define POLY_TRACE_TSC 1
+#endif
+
+/** Fight timelines
+ *
+ * TRACE_SCOPE("name") records how long the enclosing scope took. Events go to
+ * a buffer owned by the calling thread, so recording never takes a lock: it is
+ * a timestamp read on entry, and one on exit plus three stores.
+ *
+ * A thread only records once it called TRACE_THREAD(), which hands it a buffer.
+ * That is the only place that allocates or locks, so do it when the thread
+ * starts, not in the middle of the work being measured. The test runner does
+ * it for the main thread. Events of threads that never did are dropped.
+ * When a thread exits, its buffer keeps its events and is handed to the next
+ * thread that registers, so the buffers follow the threads alive at once.
+ *
+ * Tracing is only compiled in when POLY_TRACING is defined (cmake -DPOLY_TRACING=ON).
+ * Otherwise, TRACE_SCOPE and TRACE_THREAD expand to empty statements.
+ *
+ * trace::write_chrome_json() dumps everything in Chrome trace-event format,
+ * which loads in chrome://tracing as well as in the Perfetto UI.
+ */
+namespace trace {
+    // Raw timestamp. The TSC on x86, nanoseconds elsewhere. Converted at flush time.
+    inline std::uint64_t now()
+    {
+#ifdef POLY_TRACE_TSC
+        return __rdtsc();
+#else
+        return std::uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+    }
+
+    struct Event {
+        const char *    name;           // must be a string literal, or live as long as the trace
+        std::uint64_t   begin;
+        std::uint64_t   end;
+    };
+
+    struct ThreadBuffer {
+        static constexpr std::size_t capacity = 1 << 16;
+
+        std::atomic<std::size_t>    size{0};
+        std::atomic<std::size_t>    dropped{0};
+        std::uint32_t               thread_id = 0;
+        Event                       events[capacity];
+    };
+
+    // Buffer of the calling thread, null until it registers.
+    inline thread_local ThreadBuffer * thread_buffer = nullptr;
+
+    // Events recorded by threads that did not register.
+    inline std::atomic<std::size_t> unregistered{0};
+
+    // Gives the calling thread a buffer, reusing one of an exited thread if
+    // possible. Does nothing if the thread already has one.
+    void register_thread();
+
+    inline void record(const char * name, std::uint64_t begin, std::uint64_t end)
+    {
+        auto buffer = thread_buffer;
+        if (!buffer) {
+            unregistered.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        // Only this thread writes, the release store publishes the event to the flush.
+        const auto index = buffer->size.load(std::memory_order_relaxed);
+        if (index == ThreadBuffer::capacity) {
+            buffer->dropped.store(buffer->dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return;
+        }
+        buffer->events[index] = { name, begin, end };
+        buffer->size.store(index + 1, std::memory_order_release);
+    }
+
+    class Scope {
+        const char *    name_;
+        std::uint64_t   begin_;
+    public:
+        explicit Scope(const char * name) : name_(name), begin_(now()) {}
+        ~Scope() { record(name_, begin_, now()); }
+        Scope(const Scope &) = delete;
+        Scope & operator=(const Scope &) = delete;
+    };
+
+    // Writes all events recorded so far, by all threads.
+    void write_chrome_json(std::ostream & output);
+
+    // Forgets all events. Threads must not be tracing while this runs.
+    void clear();
+
+    // Number of events lost because a thread buffer was full, or missing.
+    std::size_t dropped();
+}
+
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+
+#ifdef POLY_TRACING
+#define TRACE_SCOPE(name) const ::trace::Scope TRACE_CONCAT(trace_scope_, __LINE__){name}
+#define TRACE_THREAD() ::trace::register_thread()
+#else
+#define TRACE_SCOPE(name) do {} while (false)
+#define TRACE_THREAD() do {} while (false)
+#endif
+
+#endif
@@ -7,8 +7,14 @@
 #include <catch.hpp>
 #include <fmt/core.h>
 #include <iostream>
+#include <memory>
+#include <memory_resource>
 #include <string>
+#include <vector>
+#include "arena.h"
+#include "allocations.h"
 #include "health.h"
+#include "trace.h"
 using fmt::format;
 
 // ===========================================================================
@@ -19,6 +25,7 @@ using Comment = std::string;
 enum class Weapon { Stick, Arrow, Fireball };
 
 struct Monster {
+    virtual ~Monster() = default;
     virtual Comment hit(Weapon, HealthPoints) = 0;
     virtual bool dead() const = 0;
 };
@@ -26,15 +33,19 @@ struct Monster {
 // ===========================================================================
 // Monsters
 
-class Wolf : public Monster {
-    Name            name_;
+// The name type is a parameter only so that arena monsters, further down,
+// can share the code. Everything else uses Wolf and Firelord.
+template <typename NameT>
+class BasicWolf : public Monster {
+    NameT           name_;
     HealthPoints    health_;
 public:
-    Wolf(Name name, HealthPoints hp)
+    BasicWolf(NameT name, HealthPoints hp)
         : name_(std::move(name)), health_(hp) {}
 
     Comment hit(Weapon, HealthPoints damage) override
     {
+        TRACE_SCOPE("hit Wolf");
         health_ = max(HealthPoints{0}, health_ - damage);
         return format("{} the wolf growls as it takes {} damage from the hit.", name_, damage.value);
     }
@@ -42,22 +53,24 @@ public:
     bool dead() const override { return !health_; }
 };
 
-class Firelord : public Monster {
-    Name            name_;
+template <typename NameT>
+class BasicFirelord : public Monster {
+    NameT           name_;
     HealthPoints    health_;
 public:
-    Firelord(Name name, HealthPoints hp)
+    BasicFirelord(NameT name, HealthPoints hp)
         : name_(std::move(name)), health_(hp) {}
 
     Comment hit(Weapon weapon, HealthPoints damage) override
     {
+        TRACE_SCOPE("hit Firelord");
         switch (weapon) {
         case Weapon::Stick:
             health_ = max(HealthPoints{0}, health_ - damage / 2);
             return format("{} the Firelord resists wooden stick and only takes {} damage.",
                           name_, (damage / 2).value);
         case Weapon::Fireball:
-            return format("{} the Firelord is immune to fireballs. He laughs at you.");
+            return format("{} the Firelord is immune to fireballs. He laughs at you.", name_);
         default:
             health_ = max(HealthPoints{0}, health_ - damage);
             return format("{} the Firelord roars {} damage from the hit.", name_, damage.value);
@@ -67,10 +80,14 @@ public:
     bool dead() const override { return !health_; }
 };
 
+using Wolf = BasicWolf<Name>;
+using Firelord = BasicFirelord<Name>;
+
 class Ghost : public Monster {
 public:
     Comment hit(Weapon, HealthPoints) override
     {
+        TRACE_SCOPE("hit Ghost");
         return "Ghosts are immortal. You are doomed.";
     }
 
@@ -83,6 +100,7 @@ public:
 
 int fight(Monster& monster, Weapon weapon, int attempts = 5)
 {
+    TRACE_SCOPE("fight");
     for (int attempt = 1; attempt <= attempts; ++attempt) {
         std::cout <<monster.hit(weapon, HealthPoints{40}) <<'\n';
         if (monster.dead())
@@ -108,6 +126,29 @@ int fight(Monster& monster, Weapon weapon, int attempts = 5)
 
 
 
+// ===========================================================================
+// Spawning monsters in bulk
+
+/* With inheritance, monsters of different types are usually spawned on the
+ * heap, one allocation each, plus one for each name too long for the string's
+ * internal buffer. Freeing an encounter then means as many frees.
+ *
+ * An EncounterArena (see arena.h) puts them all, names included, next to each
+ * other in a single block, and drops them all at once. The monsters above
+ * keep their names in a std::string, which always allocates from the heap.
+ * Arena monsters are the same class templates with a pmr string for a name:
+ * built with the arena's resource, it is moved in allocator and all.
+ */
+using ArenaName = std::pmr::string;
+using ArenaWolf = BasicWolf<ArenaName>;
+using ArenaFirelord = BasicFirelord<ArenaName>;
+
+template <typename T>
+T & spawn(EncounterArena & arena, const char * name, HealthPoints hp)
+{
+    return arena.spawn<T>(ArenaName(name, arena.resource()), hp);
+}
+
 // ===========================================================================
 // Exercising the code
 
@@ -136,3 +177,111 @@ TEST_CASE("Ghosts cannot be killed") {
     CHECK(attempts == 5);
     CHECK(!astrid.dead());
 }
+
+TEST_CASE("Fighting a wolf only allocates for the comments") {
+    auto wilhelm = Wolf("Wilhelm", HealthPoints{100});
+
+    const auto stats = count_allocations([&] { fight(wilhelm, Weapon::Stick); });
+
+    CHECK_THAT(stats, Allocates(3));     // 40 damage a hit against 100 HP, each hit formats its comment
+}
+
+TEST_CASE("Spawning a monster on the heap allocates once") {
+    const auto stats = count_allocations([] {
+        std::unique_ptr<Monster> wilhelm = std::make_unique<Wolf>("Wilhelm", HealthPoints{100});
+    });
+
+    CHECK_THAT(stats, Allocates(1));
+    CHECK(stats.deallocations == 1);
+}
+
+namespace {
+    // Long enough not to fit in the string itself
+    constexpr const char * long_names[] = {
+        "Wilhelm the Magnificent, Terror of the Black Forest",
+        "Gerhard, Lord of Fire and Keeper of the Molten Throne",
+    };
+}
+
+TEST_CASE("Monsters spawned in an arena fight like any other") {
+    EncounterArena arena;
+    auto & wilhelm = spawn<ArenaWolf>(arena, long_names[0], HealthPoints{100});
+    auto & gerhard = spawn<ArenaFirelord>(arena, long_names[1], HealthPoints{100});
+    auto & astrid = arena.spawn<Ghost>();
+
+    CHECK(fight(wilhelm, Weapon::Stick) == 3);
+    CHECK(fight(gerhard, Weapon::Stick) == 5);
+    CHECK(fight(astrid, Weapon::Arrow) == 5);
+    CHECK(arena.size() == 3);
+
+    arena.reset();
+
+    CHECK(arena.size() == 0);
+}
+
+TEST_CASE("Encounters reuse the memory of the previous ones") {
+    { EncounterArena warmup; }      // makes sure this thread has a block in its pool
+
+    const auto stats = count_allocations([] {
+        for (int encounter = 0; encounter < 10; ++encounter) {
+            EncounterArena arena;
+            for (int i = 0; i < 100; ++i)
+                spawn<ArenaWolf>(arena, long_names[0], HealthPoints{100});
+        }
+    });
+
+    CHECK_THAT(stats, AllocatesNothing());
+}
+
+// This executable links the counting operator new, so each heap spawn below
+// also updates a few thread-local counters. Next to malloc that is noise.
+TEST_CASE("Arena against heap allocation", "[!benchmark]") {
+    constexpr int monsters = 1000;
+
+    BENCHMARK("spawn and teardown, make_unique") {
+        std::vector<std::unique_ptr<Monster>> encounter;
+        for (int i = 0; i < monsters; ++i) {
+            if (i % 2)
+                encounter.push_back(std::make_unique<Wolf>(long_names[0], HealthPoints{100}));
+            else
+                encounter.push_back(std::make_unique<Firelord>(long_names[1], HealthPoints{100}));
+        }
+        return encounter.size();
+    };
+
+    BENCHMARK("spawn and teardown, arena") {
+        EncounterArena arena;
+        std::pmr::vector<Monster *> encounter(arena.resource());
+        for (int i = 0; i < monsters; ++i) {
+            if (i % 2)
+                encounter.push_back(&spawn<ArenaWolf>(arena, long_names[0], HealthPoints{100}));
+            else
+                encounter.push_back(&spawn<ArenaFirelord>(arena, long_names[1], HealthPoints{100}));
+        }
+        return encounter.size();
+    };
+
+    std::vector<std::unique_ptr<Monster>> scattered;
+    std::vector<std::unique_ptr<std::string>> noise;   // unrelated allocations in between monsters
+    EncounterArena arena;
+    std::vector<Monster *> packed;
+    for (int i = 0; i < monsters; ++i) {
+        scattered.push_back(std::make_unique<Wolf>(long_names[0], HealthPoints{1'000'000}));
+        noise.push_back(std::make_unique<std::string>(long_names[1]));
+        packed.push_back(&spawn<ArenaWolf>(arena, long_names[0], HealthPoints{1'000'000}));
+    }
+
+    BENCHMARK("hits, make_unique") {
+        std::size_t length = 0;
+        for (auto & monster : scattered)
+            length += monster->hit(Weapon::Arrow, HealthPoints{1}).size();
+        return length;
+    };
+
+    BENCHMARK("hits, arena") {
+        std::size_t length = 0;
+        for (auto monster : packed)
+            length += monster->hit(Weapon::Arrow, HealthPoints{1}).size();
+        return length;
+    };
+}
@@ -20,8 +20,12 @@
 #include <fmt/core.h>
 #include <concepts>
 #include <iostream>
+#include <span>
 #include <string>
+#include <tuple>
+#include <vector>
 #include "health.h"
+#include "trace.h"
 using fmt::format;
 
 // ===========================================================================
@@ -56,6 +60,7 @@ public:
 
     Comment hit(Weapon, HealthPoints damage)
     {
+        TRACE_SCOPE("hit Wolf");
         health_ = max(HealthPoints{0}, health_ - damage);
         return format("{} the wolf growls as it takes {} damage from the hit.", name_, damage.value);
     }
@@ -72,13 +77,14 @@ public:
 
     Comment hit(Weapon weapon, HealthPoints damage)
     {
+        TRACE_SCOPE("hit Firelord");
         switch (weapon) {
         case Weapon::Stick:
             health_ = max(HealthPoints{0}, health_ - damage / 2);
             return format("{} the Firelord resists wooden stick and only takes {} damage.",
                 name_, (damage / 2).value);
         case Weapon::Fireball:
-            return format("{} the Firelord is immune to fireballs. He laughs at you.");
+            return format("{} the Firelord is immune to fireballs. He laughs at you.", name_);
         default:
             health_ = max(HealthPoints{0}, health_ - damage);
             return format("{} the Firelord roars {} damage from the hit.", name_, damage.value);
@@ -92,6 +98,7 @@ class Ghost {
 public:
     Comment hit(Weapon, HealthPoints)
     {
+        TRACE_SCOPE("hit Ghost");
         return "Ghosts are immortal. You are doomed.";
     }
 
@@ -109,6 +116,7 @@ public:
  */
 int fight(Monster auto & monster, Weapon weapon, int attempts = 5)
 {
+    TRACE_SCOPE("fight");
     for (int attempt = 1; attempt <= attempts; ++attempt) {
         std::cout <<monster.hit(weapon, HealthPoints{40}) <<'\n';
         if (monster.dead())
@@ -117,6 +125,86 @@ int fight(Monster auto & monster, Weapon weapon, int attempts = 5)
     return attempts;
 }
 
+// ===========================================================================
+// Rosters known at compile time
+
+/** When the composition of an encounter is known at compile time, we do not
+ * need a base class or a variant to put monsters together: we can keep one
+ * std::vector per type, and let the compiler write one loop per type.
+ *
+ * Every loop then only ever sees a single type, so there is no dispatch at
+ * all and it can be inlined and optimized as if we wrote it by hand.
+ *
+ * The concept guards the whole set: MonsterSet<Wolf, int> will not compile.
+ */
+template <Monster... Ts>
+class MonsterSet {
+    std::tuple<std::vector<Ts>...>  monsters_;
+
+    template <typename... Us>
+    void loop(auto && func)
+    {
+        (..., [&] { for (auto & monster : of<Us>()) func(monster); }());
+    }
+
+    template <typename... Us>
+    void loop(auto && func) const
+    {
+        (..., [&] { for (const auto & monster : of<Us>()) func(monster); }());
+    }
+
+public:
+    // Whether T is one of the types of the set.
+    template <typename T>
+    static constexpr bool holds = (std::same_as<T, Ts> || ...);
+
+    template <Monster T>
+    void add(T monster) { of<T>().push_back(std::move(monster)); }
+
+    // All monsters of a single type
+    template <Monster T> std::vector<T> & of() { return std::get<std::vector<T>>(monsters_); }
+    template <Monster T> std::span<const T> of() const { return std::get<std::vector<T>>(monsters_); }
+
+    std::size_t size() const { return (of<Ts>().size() + ...); }
+
+    // Call func on every monster, one homogeneous loop per type.
+    // Given types, only loops over those: pack.for_each<Wolf, Ghost>(func).
+    template <Monster... Us> requires (holds<Us> && ...)
+    void for_each(auto && func)
+    {
+        if constexpr (sizeof...(Us) == 0)
+            loop<Ts...>(func);
+        else
+            loop<Us...>(func);
+    }
+
+    template <Monster... Us> requires (holds<Us> && ...)
+    void for_each(auto && func) const
+    {
+        if constexpr (sizeof...(Us) == 0)
+            loop<Ts...>(func);
+        else
+            loop<Us...>(func);
+    }
+
+    template <Monster... Us> requires (holds<Us> && ...)
+    std::size_t count_dead() const
+    {
+        std::size_t count = 0;
+        for_each<Us...>([&](const auto & monster) { count += monster.dead(); });
+        return count;
+    }
+
+    // Fight every monster in turn, returns the total number of attempts.
+    int fight_all(Weapon weapon, int attempts = 5)
+    {
+        TRACE_SCOPE("fight_all");
+        int total = 0;
+        for_each([&](auto & monster) { total += fight(monster, weapon, attempts); });
+        return total;
+    }
+};
+
 // ===========================================================================
 // Exercising the code
 
@@ -145,3 +233,77 @@ TEST_CASE("Ghosts cannot be killed") {
     CHECK(attempts == 5);
     CHECK(!astrid.dead());
 }
+
+TEST_CASE("A monster set fights all its monsters") {
+    auto pack = MonsterSet<Wolf, Firelord, Ghost>{};
+    pack.add(Wolf("Wilhelm", HealthPoints{100}));
+    pack.add(Wolf("Wolfgang", HealthPoints{40}));
+    pack.add(Firelord("Gerhard", HealthPoints{100}));
+    pack.add(Ghost());
+
+    const auto attempts = pack.fight_all(Weapon::Stick);
+
+    CHECK(pack.size() == 4);
+    CHECK(attempts == 3 + 1 + 5 + 5);
+    CHECK(pack.count_dead() == 3);
+    CHECK(pack.of<Wolf>().size() == 2);
+    CHECK(pack.of<Ghost>().size() == 1);
+}
+
+template <typename Set, typename T>
+concept CanCountDead = requires (const Set & set) { set.template count_dead<T>(); };
+
+TEST_CASE("A monster set only loops over the types it is asked for") {
+    auto pack = MonsterSet<Wolf, Firelord, Ghost>{};
+    pack.add(Wolf("Wilhelm", HealthPoints{100}));
+    pack.add(Firelord("Gerhard", HealthPoints{100}));
+    pack.add(Ghost());
+    pack.add(Wolf("Wolfgang", HealthPoints{100}));
+
+    std::vector<std::string> comments;
+    pack.for_each<Ghost, Wolf>([&](auto & monster) { comments.push_back(monster.hit(Weapon::Arrow, HealthPoints{100})); });
+
+    CHECK(comments == std::vector<std::string>{
+        "Ghosts are immortal. You are doomed.",
+        "Wilhelm the wolf growls as it takes 100 damage from the hit.",
+        "Wolfgang the wolf growls as it takes 100 damage from the hit.",
+    });
+    CHECK(pack.count_dead<Wolf>() == 2);
+    CHECK(pack.count_dead<Firelord, Ghost>() == 0);
+    CHECK(pack.count_dead() == 2);
+
+    // Asking for a type the set does not hold does not compile.
+    STATIC_REQUIRE(!CanCountDead<MonsterSet<Wolf, Ghost>, Firelord>);
+}
+
+TEST_CASE("A monster set loops as fast as hand-written loops", "[!benchmark]") {
+    auto pack = MonsterSet<Wolf, Firelord>{};
+    auto wolves = std::vector<Wolf>{};
+    auto firelords = std::vector<Firelord>{};
+    for (int i = 0; i < 1000; ++i) {
+        pack.add(Wolf("Wilhelm", HealthPoints{1'000'000}));
+        pack.add(Firelord("Gerhard", HealthPoints{1'000'000}));
+        wolves.emplace_back("Wilhelm", HealthPoints{1'000'000});
+        firelords.emplace_back("Gerhard", HealthPoints{1'000'000});
+    }
+
+    BENCHMARK("count_dead") { return pack.count_dead(); };
+    BENCHMARK("count_dead, hand-written") {
+        std::size_t count = 0;
+        for (const auto & wolf : wolves) count += wolf.dead();
+        for (const auto & firelord : firelords) count += firelord.dead();
+        return count;
+    };
+
+    BENCHMARK("for_each hit") {
+        std::size_t length = 0;
+        pack.for_each([&](auto & monster) { length += monster.hit(Weapon::Arrow, HealthPoints{1}).size(); });
+        return length;
+    };
+    BENCHMARK("for_each hit, hand-written") {
+        std::size_t length = 0;
+        for (auto & wolf : wolves) length += wolf.hit(Weapon::Arrow, HealthPoints{1}).size();
+        for (auto & firelord : firelords) length += firelord.hit(Weapon::Arrow, HealthPoints{1}).size();
+        return length;
+    };
+}
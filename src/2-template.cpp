@@ -13,6 +13,7 @@
 #include <iostream>
 #include <string>
 #include "health.h"
+#include "trace.h"
 using fmt::format;
 
 // ===========================================================================
@@ -36,6 +37,7 @@ public:
 
     Comment hit(Weapon, HealthPoints damage)
     {
+        TRACE_SCOPE("hit Wolf");
         health_ = max(HealthPoints{0}, health_ - damage);
         return format("{} the wolf growls as it takes {} damage from the hit.", name_, damage.value);
     }
@@ -52,6 +54,7 @@ public:
 
     Comment hit(Weapon weapon, HealthPoints damage)
     {
+        TRACE_SCOPE("hit Firelord");
         switch (weapon) {
         case Weapon::Stick:
             health_ = max(HealthPoints{0}, health_ - damage / 2);
@@ -72,6 +75,7 @@ class Ghost {
 public:
     Comment hit(Weapon, HealthPoints)
     {
+        TRACE_SCOPE("hit Ghost");
         return "Ghosts are immortal. You are doomed.";
     }
 
@@ -86,6 +90,7 @@ public:
 template <typename Monster>
 int fight(Monster& monster, Weapon weapon, int attempts = 5)
 {
+    TRACE_SCOPE("fight");
     for (int attempt = 1; attempt <= attempts; ++attempt) {
         std::cout <<monster.hit(weapon, HealthPoints{40}) <<'\n';
         if (monster.dead())
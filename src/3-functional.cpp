@@ -10,7 +10,11 @@
 #include <fmt/core.h>
 #include <iostream>
 #include <string>
+#include <thread>
+#include <vector>
+#include "atomic_health.h"
 #include "health.h"
+#include "trace.h"
 using fmt::format;
 
 // ===========================================================================
@@ -39,12 +43,14 @@ struct Ghost {};
 
 Comment hit(Wolf & wolf, Weapon, HealthPoints damage)
 {
+    TRACE_SCOPE("hit Wolf");
     wolf.health = max(HealthPoints{0}, wolf.health - damage);
     return format("{} the wolf growls as it takes {} damage from the hit.", wolf.name, damage.value);
 }
 
 Comment hit(Firelord & firelord, Weapon weapon, HealthPoints damage)
 {
+    TRACE_SCOPE("hit Firelord");
     switch (weapon) {
     case Weapon::Stick:
         firelord.health = max(HealthPoints{0}, firelord.health - damage / 2);
@@ -60,6 +66,7 @@ Comment hit(Firelord & firelord, Weapon weapon, HealthPoints damage)
 
 Comment hit(Ghost&, Weapon, HealthPoints)
 {
+    TRACE_SCOPE("hit Ghost");
     return "Ghosts are immortal. You are doomed.";
 }
 
@@ -82,6 +89,7 @@ bool dead(const Ghost &) { return false; }
 template <typename Monster>
 int fight(Monster& monster, Weapon weapon, int attempts = 5)
 {
+    TRACE_SCOPE("fight");
     for (int attempt = 1; attempt <= attempts; ++attempt) {
         std::cout <<hit(monster, weapon, HealthPoints{40}) <<'\n';
         if (dead(monster))
@@ -90,6 +98,48 @@ int fight(Monster& monster, Weapon weapon, int attempts = 5)
     return attempts;
 }
 
+// ===========================================================================
+// Raid bosses
+
+/* Because hit() is a free function, nothing forces a monster to keep its
+ * health in a plain HealthPoints. A raid boss is hit by hundreds of players at
+ * the same time, so it keeps it in a ContendedHealthPoints instead and gets its
+ * own hit() overload. The generic dead() and fight() work on it unchanged.
+ */
+struct RaidFirelord {
+    Name                        name;
+    ContendedHealthPoints<>     health;
+};
+
+// Thread-safe part of the hit. Exactly one call ever reports the kill.
+DamageOutcome strike(RaidFirelord & firelord, Weapon weapon, HealthPoints damage)
+{
+    TRACE_SCOPE("strike RaidFirelord");
+    switch (weapon) {
+    case Weapon::Stick:     return firelord.health.subtract(damage / 2);
+    case Weapon::Fireball:  return { HealthPoints{0}, false };
+    default:                return firelord.health.subtract(damage);
+    }
+}
+
+Comment hit(RaidFirelord & firelord, Weapon weapon, HealthPoints damage)
+{
+    TRACE_SCOPE("hit RaidFirelord");
+    const auto outcome = strike(firelord, weapon, damage);
+    if (outcome.killed)
+        return format("{} the Firelord collapses under the blows of the raid.", firelord.name);
+
+    switch (weapon) {
+    case Weapon::Stick:
+        return format("{} the Firelord resists wooden stick and only takes {} damage.",
+                      firelord.name, (damage / 2).value);
+    case Weapon::Fireball:
+        return format("{} the Firelord is immune to fireballs. He laughs at you.", firelord.name);
+    default:
+        return format("{} the Firelord roars {} damage from the hit.", firelord.name, damage.value);
+    }
+}
+
 // ===========================================================================
 // Exercising the code
 
@@ -118,3 +168,88 @@ TEST_CASE("Ghosts cannot be killed") {
     CHECK(attempts == 5);
     CHECK(!dead(astrid));
 }
+
+namespace {
+    struct RaidTally { int applied = 0; int kills = 0; };
+
+    // Every thread strikes `hits` times. Nothing is settled afterwards: the
+    // strikes alone must have applied all the damage and reported the kill.
+    template <typename Strike>
+    RaidTally raid(int threads, int hits, Strike strike)
+    {
+        std::vector<RaidTally> tallies(static_cast<std::size_t>(threads));
+        std::vector<std::thread> players;
+        for (auto & tally : tallies) {
+            players.emplace_back([&tally, hits, strike] {
+                TRACE_THREAD();
+                for (int i = 0; i < hits; ++i) {
+                    const auto outcome = strike();
+                    tally.applied += outcome.applied.value;
+                    tally.kills += outcome.killed;
+                }
+            });
+        }
+        for (auto & player : players)
+            player.join();
+
+        RaidTally total;
+        for (const auto & tally : tallies) {
+            total.applied += tally.applied;
+            total.kills += tally.kills;
+        }
+        return total;
+    }
+}
+
+TEST_CASE("Raid bosses die exactly once and every point of damage counts") {
+    auto ragnaros = RaidFirelord{"Ragnaros", ContendedHealthPoints<>{HealthPoints{1'000'000}}};
+
+    const auto tally = raid(16, 100'000, [&] { return strike(ragnaros, Weapon::Arrow, HealthPoints{3}); });
+
+    CHECK(tally.kills == 1);
+    CHECK(tally.applied == 1'000'000);
+    CHECK(ragnaros.health.load().value == 0);
+    CHECK(dead(ragnaros));
+    CHECK(ragnaros.health.settle().applied.value == 0);
+}
+
+TEST_CASE("Raid bosses lose exactly the damage dealt when they survive") {
+    auto ragnaros = RaidFirelord{"Ragnaros", ContendedHealthPoints<>{HealthPoints{10'000'000}}};
+
+    const auto tally = raid(16, 100'000, [&] { return strike(ragnaros, Weapon::Arrow, HealthPoints{3}); });
+
+    CHECK(tally.kills == 0);
+    CHECK(tally.applied == 16 * 100'000 * 3);
+    CHECK(ragnaros.health.load().value == 10'000'000 - 16 * 100'000 * 3);
+    CHECK(!dead(ragnaros));
+}
+
+TEST_CASE("Parked damage is folded by the hits themselves") {
+    // Parks every single hit, whether there is contention or not.
+    ContendedHealthPoints<16, -1> health{HealthPoints{1'000'000}};
+
+    const auto tally = raid(16, 100'000, [&] { return health.subtract(HealthPoints{3}); });
+
+    CHECK(tally.kills == 1);
+    CHECK(tally.applied == 1'000'000);
+    CHECK(health.load().value == 0);
+    CHECK(health.settle().applied.value == 0);
+}
+
+TEST_CASE("Raid bosses keep their Firelord comments") {
+    auto ragnaros = RaidFirelord{"Ragnaros", ContendedHealthPoints<>{HealthPoints{100}}};
+
+    CHECK(hit(ragnaros, Weapon::Stick, HealthPoints{20}) == "Ragnaros the Firelord resists wooden stick and only takes 10 damage.");
+    CHECK(hit(ragnaros, Weapon::Fireball, HealthPoints{20}) == "Ragnaros the Firelord is immune to fireballs. He laughs at you.");
+    CHECK(hit(ragnaros, Weapon::Arrow, HealthPoints{20}) == "Ragnaros the Firelord roars 20 damage from the hit.");
+    CHECK(hit(ragnaros, Weapon::Arrow, HealthPoints{100}) == "Ragnaros the Firelord collapses under the blows of the raid.");
+}
+
+TEST_CASE("Raid bosses can still be fought alone") {
+    auto ragnaros = RaidFirelord{"Ragnaros", ContendedHealthPoints<>{HealthPoints{100}}};
+
+    const auto attempts = fight(ragnaros, Weapon::Stick);
+
+    CHECK(attempts == 5);
+    CHECK(dead(ragnaros));
+}
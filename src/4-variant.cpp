@@ -13,7 +13,10 @@
 #include <iostream>
 #include <string>
 #include <variant>
+#include <vector>
 #include "health.h"
+#include "timer_wheel.h"
+#include "trace.h"
 using fmt::format;
 
 // NO CHANGE AT ALL UNTIL YOU SEE "CHANGES START HERE"
@@ -43,12 +46,14 @@ struct Ghost {};
 
 Comment hit(Wolf & wolf, Weapon, HealthPoints damage)
 {
+    TRACE_SCOPE("hit Wolf");
     wolf.health = max(HealthPoints{0}, wolf.health - damage);
     return format("{} the wolf growls as it takes {} damage from the hit.", wolf.name, damage.value);
 }
 
 Comment hit(Firelord & firelord, Weapon weapon, HealthPoints damage)
 {
+    TRACE_SCOPE("hit Firelord");
     switch (weapon) {
     case Weapon::Stick:
         firelord.health = max(HealthPoints{0}, firelord.health - damage / 2);
@@ -64,6 +69,7 @@ Comment hit(Firelord & firelord, Weapon weapon, HealthPoints damage)
 
 Comment hit(Ghost&, Weapon, HealthPoints)
 {
+    TRACE_SCOPE("hit Ghost");
     return "Ghosts are immortal. You are doomed.";
 }
 
@@ -78,6 +84,7 @@ bool dead(const Ghost &) { return false; }
 template <typename Monster>
 int fight(Monster& monster, Weapon weapon, int attempts = 5)
 {
+    TRACE_SCOPE("fight");
     for (int attempt = 1; attempt <= attempts; ++attempt) {
         std::cout <<hit(monster, weapon, HealthPoints{40}) <<'\n';
         if (dead(monster))
@@ -112,6 +119,7 @@ using Monster = std::variant<Wolf, Firelord, Ghost>;
 
 Comment hit(Monster& monster, Weapon weapon, HealthPoints damage)
 {
+    TRACE_SCOPE("hit Monster");
     return std::visit([&](auto & value) { return hit(value, weapon, damage); }, monster);
 }
 
@@ -141,6 +149,80 @@ bool dead(Monster& monster)
 // work fine, and use our hit() and dead() implementations for our variant.
 
 
+// ===========================================================================
+// Timed encounters
+
+/* fight() hits back-to-back. In a real game, attackers have a cooldown between
+ * hits and thousands of encounters run side by side, each at its own pace.
+ *
+ * Each encounter becomes a timer: when it fires, we do one attempt using the
+ * same hit() and dead() as fight(), then schedule the next attempt one
+ * cooldown later. Time is simulated: it only moves when run() is called.
+ */
+class EncounterScheduler {
+public:
+    using Tick = std::uint64_t;
+    using EncounterId = std::uint32_t;
+
+    struct Encounter {
+        Monster *       monster;
+        Weapon          weapon;
+        Tick            cooldown;
+        int             attempts;       // attempts done so far
+        int             max_attempts;
+        bool            finished;       // dead, out of attempts, or cancelled
+    };
+
+private:
+    TimerWheel<EncounterId>                         wheel_;
+    std::vector<Encounter>                          encounters_;
+    std::vector<TimerWheel<EncounterId>::Handle>    timers_;
+
+public:
+    // Starts an encounter whose first attempt happens after `delay` ticks.
+    EncounterId start(Monster & monster, Weapon weapon, Tick cooldown, Tick delay = 0, int attempts = 5)
+    {
+        const auto id = EncounterId(encounters_.size());
+        encounters_.push_back({ &monster, weapon, cooldown, 0, attempts, attempts <= 0 });
+        if (encounters_.back().finished)
+            timers_.push_back({});      // no attempt to make, over before it starts
+        else
+            timers_.push_back(wheel_.schedule(delay, id));
+        return id;
+    }
+
+    void cancel(EncounterId id)
+    {
+        if (encounters_[id].finished)
+            return;
+        wheel_.cancel(timers_[id]);
+        encounters_[id].finished = true;
+    }
+
+    // Runs the simulation for a number of ticks.
+    void run(Tick ticks)
+    {
+        wheel_.advance(ticks, [this](Tick, std::vector<EncounterId> & due) {
+            for (const auto id : due) {
+                auto & encounter = encounters_[id];
+                if (encounter.finished)
+                    continue;
+                hit(*encounter.monster, encounter.weapon, HealthPoints{40});
+                ++encounter.attempts;
+                if (dead(*encounter.monster) || encounter.attempts >= encounter.max_attempts)
+                    encounter.finished = true;
+                else
+                    timers_[id] = wheel_.schedule(encounter.cooldown, id);
+            }
+        });
+    }
+
+    Tick now() const { return wheel_.now(); }
+    std::size_t pending() const { return wheel_.size(); }
+    const Encounter & operator[](EncounterId id) const { return encounters_[id]; }
+};
+
+
 
 
 
@@ -174,3 +256,108 @@ TEST_CASE("Ghosts cannot be killed") {
     CHECK(attempts == 5);
     CHECK(!dead(std::get<Ghost>(astrid)));
 }
+
+TEST_CASE("Timed encounters take their cooldown into account") {
+    Monster wilhelm = Wolf{"Wilhelm", HealthPoints{100}};
+    Monster astrid = Ghost();
+    auto scheduler = EncounterScheduler();
+    const auto wolf_fight = scheduler.start(wilhelm, Weapon::Stick, 10);
+    const auto ghost_fight = scheduler.start(astrid, Weapon::Arrow, 100, 50);
+
+    scheduler.run(20);          // wolf hit at ticks 1 and 11
+
+    CHECK(scheduler[wolf_fight].attempts == 2);
+    CHECK(!dead(wilhelm));
+
+    scheduler.run(1);           // tick 21, third hit
+
+    CHECK(scheduler[wolf_fight].attempts == 3);
+    CHECK(scheduler[wolf_fight].finished);
+    CHECK(dead(wilhelm));
+    CHECK(scheduler[ghost_fight].attempts == 0);
+
+    scheduler.run(1000);
+
+    CHECK(scheduler[ghost_fight].attempts == 5);
+    CHECK(scheduler[ghost_fight].finished);
+    CHECK(scheduler.pending() == 0);
+}
+
+TEST_CASE("Encounters without attempts never hit") {
+    Monster wilhelm = Wolf{"Wilhelm", HealthPoints{100}};
+    auto scheduler = EncounterScheduler();
+    const auto id = scheduler.start(wilhelm, Weapon::Stick, 10, 0, 0);
+
+    scheduler.run(100);
+
+    CHECK(scheduler[id].finished);
+    CHECK(scheduler[id].attempts == 0);
+    CHECK(scheduler.pending() == 0);
+    CHECK(std::get<Wolf>(wilhelm).health.value == 100);
+}
+
+TEST_CASE("Cancelled encounters stop hitting") {
+    Monster gerhard = Firelord{"Gerhard", HealthPoints{100}};
+    auto scheduler = EncounterScheduler();
+    const auto id = scheduler.start(gerhard, Weapon::Arrow, 5);
+
+    scheduler.run(1);
+    scheduler.cancel(id);
+    scheduler.run(100);
+
+    CHECK(scheduler[id].attempts == 1);
+    CHECK(scheduler[id].finished);
+    CHECK(!dead(gerhard));
+}
+
+TEST_CASE("Timers fire exactly on time, however far away") {
+    auto wheel = TimerWheel<std::uint64_t>();
+    std::uint64_t delay = 1;
+    for (int i = 0; i < 2000; ++i) {
+        wheel.schedule(delay, delay);
+        delay = delay * 7 % 40'000'039 + 1;     // spread over more than the 2^24 ticks of the wheel
+    }
+    const auto cancelled = wheel.schedule(12345, 0);
+    CHECK(wheel.cancel(cancelled));
+    CHECK(!wheel.cancel(cancelled));
+
+    std::size_t fired = 0, late = 0;
+    wheel.advance(40'000'040, [&](std::uint64_t tick, std::vector<std::uint64_t> & due) {
+        for (const auto expected : due)
+            late += (expected != tick);
+        fired += due.size();
+    });
+
+    CHECK(fired == 2000);
+    CHECK(late == 0);
+    CHECK(wheel.size() == 0);
+}
+
+TEST_CASE("Scheduler overhead compared to hits", "[!benchmark]") {
+    constexpr int encounters = 100'000;
+    std::vector<Monster> monsters(encounters, Monster{Wolf{"Wilhelm", HealthPoints{1'000'000}}});
+
+    BENCHMARK("timer wheel alone, per event") {
+        auto wheel = TimerWheel<int>();
+        for (int i = 0; i < encounters; ++i)
+            wheel.schedule(std::uint64_t(1 + i % 1000), i);
+        int sum = 0;
+        wheel.advance(1000, [&](std::uint64_t, std::vector<int> & due) { for (auto i : due) sum += i; });
+        return sum;
+    };
+
+    BENCHMARK("hits alone, per event") {
+        std::size_t length = 0;
+        for (auto & monster : monsters)
+            length += hit(monster, Weapon::Arrow, HealthPoints{1}).size();
+        return length;
+    };
+
+    BENCHMARK("scheduled encounters, one attempt each") {
+        auto scheduler = EncounterScheduler();
+        for (int i = 0; i < encounters; ++i)
+            scheduler.start(monsters[std::size_t(i)], Weapon::Arrow, 10, std::uint64_t(i % 1000), 1);
+        scheduler.run(1000);
+        return scheduler.pending();
+    };
+}
@@ -9,8 +9,15 @@
  * 
  * Achieving that requires small changes in the API.
  */
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <type_traits>
 #include <variant>
 #include "health.h"
+#include "memo_cache.h"
+#include "multiversion.h"
 
 // ===========================================================================
 // Definitions
@@ -36,6 +43,10 @@ struct Firelord {
 
 struct Ghost {};
 
+// Their fur stops a quarter of the damage. See the modifiers in health.h.
+// Firelords need none: their hit() already resists sticks.
+template <> struct Resistance<Wolf> { static constexpr int percent = 75; };
+
 // ===========================================================================
 // Functions
 
@@ -90,6 +101,164 @@ constexpr auto fight(Monster monster, Weapon weapon, int attempts = 5)
     return Result{ monster, attempts };
 }
 
+// ===========================================================================
+// Weapons known at compile time
+
+/* Above, the weapon is a runtime argument, so a Firelord's hit re-checks it on
+ * every single attempt. When we know the weapon at compile time, we can make it
+ * a template parameter: `if constexpr` resolves the branches during compilation
+ * and each fight<W> only contains the code for its own weapon.
+ *
+ * Better still, some fights become trivial. Nothing can hurt a ghost, and
+ * fireballs cannot hurt a firelord: those fights are over before they start.
+ */
+template <Weapon W> constexpr Wolf hit(Wolf wolf, HealthPoints damage) { return hit(wolf, W, damage); }
+template <Weapon W> constexpr Ghost hit(Ghost ghost, HealthPoints) { return ghost; }
+
+template <Weapon W>
+constexpr Firelord hit(Firelord firelord, HealthPoints damage)
+{
+    if constexpr (W == Weapon::Stick)
+        return { firelord.name, max(HealthPoints{0}, firelord.health - damage / 2) };
+    else if constexpr (W == Weapon::Fireball)
+        return firelord;
+    else
+        return { firelord.name, max(HealthPoints{0}, firelord.health - damage) };
+}
+
+template <Weapon W, typename Monster>
+constexpr bool immune = std::is_same_v<Monster, Ghost>
+                     || (std::is_same_v<Monster, Firelord> && W == Weapon::Fireball);
+
+template <Weapon W, typename Monster>
+constexpr auto fight(Monster monster, int attempts = 5)
+{
+    struct Result { Monster monster; int attempts; };
+
+    if constexpr (immune<W, Monster>) {
+        // Only the first attempt can matter: if the monster was already dead.
+        return Result{ monster, attempts > 0 && dead(monster) ? 1 : attempts };
+    } else {
+        for (int attempt = 1; attempt <= attempts; ++attempt) {
+            monster = hit<W>(monster, HealthPoints{40});
+            if (dead(monster))
+                return Result{ monster, attempt };
+        }
+        return Result{ monster, attempts };
+    }
+}
+
+/* Batches of monsters of the same type, all fought with the same weapon.
+ * fight_batch() looks at the weapon once, for the whole batch, and picks the
+ * matching fight<W>. The kernels are also compiled once per instruction set,
+ * and the best one the CPU supports is picked the first time it is used.
+ */
+// Same result as fight<W> on each monster, but attempts are the outer loop:
+// the inner one then runs over all monsters with no early exit, which lets the
+// compiler vectorize it. Hitting a dead monster again does not change it.
+// Hits and death checks are separate passes: fused, GCC folds the clamp at
+// zero into the check, and warns that it assumes no overflow to do so.
+template <Weapon W, typename Monster>
+POLY_FORCE_INLINE void fight_batch_kernel(Monster * monsters, std::size_t count, int attempts, int * results)
+{
+    if constexpr (immune<W, Monster>) {
+        for (std::size_t i = 0; i < count; ++i)
+            results[i] = fight<W>(monsters[i], attempts).attempts;
+    } else {
+        for (std::size_t i = 0; i < count; ++i)
+            results[i] = 0;                                     // not dead yet
+        for (int attempt = 1; attempt <= attempts; ++attempt) {
+            for (std::size_t i = 0; i < count; ++i)
+                monsters[i] = hit<W>(monsters[i], HealthPoints{40});
+            for (std::size_t i = 0; i < count; ++i)
+                results[i] = results[i] == 0 && dead(monsters[i]) ? attempt : results[i];
+        }
+        for (std::size_t i = 0; i < count; ++i)
+            results[i] = results[i] == 0 ? attempts : results[i];
+    }
+}
+
+template <Weapon W, typename Monster>
+void fight_batch_baseline(Monster * monsters, std::size_t count, int attempts, int * results)
+{ fight_batch_kernel<W>(monsters, count, attempts, results); }
+
+template <Weapon W, typename Monster>
+POLY_TARGET_SSE42 void fight_batch_sse42(Monster * monsters, std::size_t count, int attempts, int * results)
+{ fight_batch_kernel<W>(monsters, count, attempts, results); }
+
+template <Weapon W, typename Monster>
+POLY_TARGET_AVX2 void fight_batch_avx2(Monster * monsters, std::size_t count, int attempts, int * results)
+{ fight_batch_kernel<W>(monsters, count, attempts, results); }
+
+template <Weapon W, typename Monster>
+POLY_TARGET_AVX512 void fight_batch_avx512(Monster * monsters, std::size_t count, int attempts, int * results)
+{ fight_batch_kernel<W>(monsters, count, attempts, results); }
+
+template <typename Monster>
+using BatchKernels = std::array<void (*)(Monster *, std::size_t, int, int *), 3>;     // one per weapon
+
+template <typename Monster>
+BatchKernels<Monster> batch_kernels(Isa isa)
+{
+    switch (isa) {
+    case Isa::Avx512:
+        return { fight_batch_avx512<Weapon::Stick, Monster>, fight_batch_avx512<Weapon::Arrow, Monster>,
+                 fight_batch_avx512<Weapon::Fireball, Monster> };
+    case Isa::Avx2:
+        return { fight_batch_avx2<Weapon::Stick, Monster>, fight_batch_avx2<Weapon::Arrow, Monster>,
+                 fight_batch_avx2<Weapon::Fireball, Monster> };
+    case Isa::Sse42:
+        return { fight_batch_sse42<Weapon::Stick, Monster>, fight_batch_sse42<Weapon::Arrow, Monster>,
+                 fight_batch_sse42<Weapon::Fireball, Monster> };
+    default:
+        return { fight_batch_baseline<Weapon::Stick, Monster>, fight_batch_baseline<Weapon::Arrow, Monster>,
+                 fight_batch_baseline<Weapon::Fireball, Monster> };
+    }
+}
+
+// Fights every monster with the same weapon, results[i] gets the attempts for monsters[i].
+template <typename Monster>
+void fight_batch(Monster * monsters, std::size_t count, Weapon weapon, int attempts, int * results)
+{
+    static const auto kernels = batch_kernels<Monster>(detect_isa());
+    kernels[std::size_t(weapon)](monsters, count, attempts, results);
+}
+
+// ===========================================================================
+// Remembering fights
+
+/* A pure function always gives the same result for the same arguments, so once
+ * we fought a 100-health wolf with a stick, we know how every such fight ends.
+ * MemoizedFight (see memo_cache.h) keeps recent results in a concurrent cache.
+ *
+ * A name does not change how a fight ends, so wolves and firelords are only
+ * known by their health. The cache never looks at the name, and gives every
+ * caller back its own.
+ */
+template <typename Monster>
+struct NamedFightKey {
+    static int key(const Monster & monster) { return monster.health.value; }
+    template <typename Result> static void restore(Result & result, const Monster & monster) { result.monster.name = monster.name; }
+};
+template <> struct FightKey<Wolf> : NamedFightKey<Wolf> {};
+template <> struct FightKey<Firelord> : NamedFightKey<Firelord> {};
+
+constexpr bool operator==(const Ghost &, const Ghost &) { return true; }
+
+namespace std {
+    template <> struct hash<Ghost> {
+        size_t operator()(const Ghost &) const { return 0; }
+    };
+}
+
+// Works with any monster fight() accepts, including ones defined elsewhere.
+template <typename Monster>
+auto memoize_fight()
+{
+    auto pure_fight = [](Monster monster, Weapon weapon, int attempts) { return fight(monster, weapon, attempts); };
+    return std::make_unique<MemoizedFight<Monster, Weapon, decltype(pure_fight)>>(pure_fight);
+}
+
 // ===========================================================================
 // Exercising the code
 
@@ -132,12 +301,81 @@ namespace GhostsCannotBeKilled {
     static_assert(!dead(result.monster));
 }
 
+/** Damage modifiers from health.h are constexpr too, so a whole chain of them
+ * can be checked at compile time, down to the batch form.
+ */
+namespace ModifiersChainIntoASingleKernel {
+    constexpr auto modifiers = armor(5) | crit(2, 25) | resist<Wolf>();
+
+    static_assert(modifiers(HealthPoints{40}, HitRoll{10}).value == (40 - 5) * 2 * 3 / 4);
+    static_assert(modifiers(HealthPoints{40}, HitRoll{50}).value == (40 - 5) * 3 / 4);
+    static_assert(modifiers(HealthPoints{4}, HitRoll{10}).value == 0);
+
+    // Poison lands with the hit, then keeps biting for two more ticks, through armor.
+    constexpr auto poisoned = dot(4, 3) | armor(2);
+
+    static_assert(poisoned(HealthPoints{40}, HitRoll{99, 0}).value == 42);
+    static_assert(poisoned(HealthPoints{0}, HitRoll{99, 1}).value == 2);
+    static_assert(poisoned(HealthPoints{0}, HitRoll{99, 2}).value == 2);
+    static_assert(poisoned(HealthPoints{0}, HitRoll{99, 3}).value == 0);
+
+    constexpr HealthPoints poisoned_total(HealthPoints damage, int ticks)
+    {
+        auto total = poisoned(damage, HitRoll{99, 0});
+        for (int tick = 1; tick < ticks; ++tick)
+            total = total + poisoned(HealthPoints{0}, HitRoll{99, tick});
+        return total;
+    }
+
+    static_assert(poisoned_total(HealthPoints{40}, 5).value == 42 + 2 + 2);
+
+    constexpr auto column_after_hit()
+    {
+        struct Column { HealthPoints health[3]; } column = { { {100}, {30}, {0} } };
+        apply_damage(modifiers, column.health, column.health + 3, HealthPoints{40}, HitRoll{99});
+        return column;
+    }
+
+    static_assert(column_after_hit().health[0].value == 74);
+    static_assert(column_after_hit().health[1].value == 4);
+    static_assert(column_after_hit().health[2].value == 0);
+
+    // Without crits, every arrow only does 26 damage through armor and fur.
+    constexpr int attempts_to_kill(Wolf wolf)
+    {
+        int attempts = 0;
+        for (; !dead(wolf); ++attempts)
+            wolf = hit(wolf, Weapon::Arrow, modifiers(HealthPoints{40}, HitRoll{99}));
+        return attempts;
+    }
+
+    constexpr auto wilhelm = Wolf{"Wilhelm", HealthPoints{100}};
+    static_assert(fight(wilhelm, Weapon::Arrow).attempts == 3);
+    static_assert(attempts_to_kill(wilhelm) == 4);
+}
+namespace FireballsAgainstFirelordsAreOverImmediately {
+    constexpr auto gerhard = Firelord{"Gerhard", HealthPoints{100}};
+
+    constexpr auto result = fight<Weapon::Fireball>(gerhard);
+
+    static_assert(result.attempts == 5);
+    static_assert(result.monster.health.value == 100);
+
+    // ...and other weapons give the same result as the runtime version
+    static_assert(fight<Weapon::Stick>(gerhard).attempts == fight(gerhard, Weapon::Stick).attempts);
+    static_assert(fight<Weapon::Arrow>(gerhard).attempts == fight(gerhard, Weapon::Arrow).attempts);
+}
 
 /** SEE HERE
  * To be clear, in real life you would not write tests like this. You would
  * do that instead:
  */
 #include <catch.hpp>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "allocations.h"
 
 TEST_CASE("Ghosts cannot be killed")
 {
@@ -147,3 +385,235 @@ TEST_CASE("Ghosts cannot be killed")
     STATIC_REQUIRE(result.attempts == 1000);    // same as static_assert, but registers it
     STATIC_REQUIRE(!dead(result.monster));      // with Catch2 so it shows in statistics :-)
 }
+
+TEST_CASE("Fighting does not allocate at all")
+{
+    auto wilhelm = Wolf{"Wilhelm", HealthPoints{100}};
+
+    const auto stats = count_allocations([&] { wilhelm = fight(wilhelm, Weapon::Stick).monster; });
+
+    CHECK_THAT(stats, AllocatesNothing());
+    CHECK(dead(wilhelm));
+}
+
+namespace {
+    constexpr Weapon weapons[] = { Weapon::Stick, Weapon::Arrow, Weapon::Fireball };
+
+    // Monsters built during compilation, make(i) gives the i-th one.
+    template <std::size_t N, typename Make>
+    constexpr auto make_monsters(Make make)
+    {
+        std::array<decltype(make(0)), N> monsters{};
+        for (std::size_t i = 0; i < N; ++i)
+            monsters[i] = make(int(i));
+        return monsters;
+    }
+
+    template <typename Monster, std::size_t N>
+    struct Fights {
+        std::array<Monster, N>  monsters;
+        std::array<int, N>      attempts;
+    };
+
+    // Same health and such, names aside: what the fight cache compares too.
+    template <typename Monster>
+    bool same_state(const Monster & lhs, const Monster & rhs)
+    {
+        return FightKey<Monster>::key(lhs) == FightKey<Monster>::key(rhs);
+    }
+
+    // One fight() per monster. Used during compilation, to get expected results
+    // the compiler does not have to recompute at runtime.
+    template <typename Monster, std::size_t N>
+    constexpr auto fight_each(const std::array<Monster, N> & monsters, Weapon weapon, int attempts = 5)
+    {
+        Fights<Monster, N> fights{};
+        for (std::size_t i = 0; i < N; ++i) {
+            const auto fought = fight(monsters[i], weapon, attempts);
+            fights.monsters[i] = fought.monster;
+            fights.attempts[i] = fought.attempts;
+        }
+        return fights;
+    }
+
+    // Same with every weapon, indexed by weapon.
+    template <typename Monster, std::size_t N>
+    constexpr auto fight_each_weapon(const std::array<Monster, N> & monsters, int attempts = 5)
+    {
+        std::array<Fights<Monster, N>, std::size(weapons)> fights{};
+        for (const auto weapon : weapons)
+            fights[std::size_t(weapon)] = fight_each(monsters, weapon, attempts);
+        return fights;
+    }
+
+    // Checks the kernels of every instruction set this CPU can run, not only
+    // the one fight_batch() picks.
+    template <typename Monster, std::size_t N>
+    void check_batches(const std::array<Monster, N> & monsters,
+                       const std::array<Fights<Monster, N>, std::size(weapons)> & expected)
+    {
+        for (auto isa = Isa::Baseline; isa <= detect_isa(); isa = Isa(int(isa) + 1)) {
+            INFO("Batch kernels built for " << isa_name(isa));
+            const auto kernels = batch_kernels<Monster>(isa);
+            for (const auto weapon : weapons) {
+                auto batch = monsters;
+                std::array<int, N> attempts;
+                kernels[std::size_t(weapon)](batch.data(), N, 5, attempts.data());
+
+                const auto & one_by_one = expected[std::size_t(weapon)];
+                for (std::size_t i = 0; i < N; ++i) {
+                    CHECK(attempts[i] == one_by_one.attempts[i]);
+                    CHECK(same_state(batch[i], one_by_one.monsters[i]));
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("Batches give the same results as fighting monsters one by one")
+{
+    static constexpr auto wolves = make_monsters<64>([](int i) { return Wolf{"Wilhelm", HealthPoints{10 * i}}; });
+    static constexpr auto firelords = make_monsters<64>([](int i) { return Firelord{"Gerhard", HealthPoints{10 * i}}; });
+    static constexpr auto ghosts = make_monsters<64>([](int) { return Ghost(); });
+    static constexpr auto wolf_fights = fight_each_weapon(wolves);
+    static constexpr auto firelord_fights = fight_each_weapon(firelords);
+    static constexpr auto ghost_fights = fight_each_weapon(ghosts);
+
+    check_batches(wolves, wolf_fights);
+    check_batches(firelords, firelord_fights);
+    check_batches(ghosts, ghost_fights);
+}
+
+// A monster this file knows nothing about, to show the cache is not limited to ours.
+struct Troll {
+    HealthPoints    health;
+    int             regeneration;
+
+    friend constexpr bool operator==(const Troll & lhs, const Troll & rhs)
+    {
+        return lhs.health.value == rhs.health.value && lhs.regeneration == rhs.regeneration;
+    }
+};
+
+constexpr Troll hit(Troll troll, Weapon, HealthPoints damage)
+{
+    const auto health = max(HealthPoints{0}, troll.health - damage);
+    return { health ? health + HealthPoints{troll.regeneration} : health, troll.regeneration };
+}
+
+namespace std {
+    template <> struct hash<Troll> {
+        size_t operator()(const Troll & troll) const { return size_t(troll.health.value) * 31 + size_t(troll.regeneration); }
+    };
+}
+
+TEST_CASE("Repeated fights are answered from the cache")
+{
+    // Each wolf gets its own number of attempts, which is part of the query too.
+    static constexpr auto wolves = make_monsters<200>([](int i) { return Wolf{"Wilhelm", HealthPoints{i + 1}}; });
+    static constexpr auto attempts = [] {
+        std::array<int, wolves.size()> result{};
+        for (std::size_t i = 0; i < result.size(); ++i)
+            result[i] = 1 + int(i % 5);
+        return result;
+    }();
+    static constexpr auto expected = [] {
+        Fights<Wolf, wolves.size()> fights{};
+        for (std::size_t i = 0; i < wolves.size(); ++i) {
+            const auto fought = fight(wolves[i], Weapon::Arrow, attempts[i]);
+            fights.monsters[i] = fought.monster;
+            fights.attempts[i] = fought.attempts;
+        }
+        return fights;
+    }();
+    auto cached_fight = memoize_fight<Wolf>();
+
+    for (int round = 0; round < 10; ++round) {
+        for (std::size_t i = 0; i < wolves.size(); ++i) {
+            const auto result = (*cached_fight)(wolves[i], Weapon::Arrow, attempts[i]);
+            CHECK(result.attempts == expected.attempts[i]);
+            CHECK(same_state(result.monster, expected.monsters[i]));
+            CHECK(result.monster.name == wolves[i].name);
+        }
+    }
+
+    const auto stats = cached_fight->stats();
+    INFO("hit rate " << stats.hit_rate());
+    CHECK(stats.misses == 200);
+    CHECK(stats.hits == 9 * 200);
+}
+
+TEST_CASE("The fight cache ignores names, and gives every caller its own back")
+{
+    const auto gerhard = Firelord{"Gerhard", HealthPoints{100}};
+    auto cached_fight = memoize_fight<Firelord>();
+
+    const auto first = (*cached_fight)(gerhard, Weapon::Stick);
+    {
+        const std::string name = "Gunther";      // gone before the cache is asked again
+        const auto result = (*cached_fight)(Firelord{name.c_str(), HealthPoints{100}}, Weapon::Stick);
+        CHECK(result.monster.name == name.c_str());
+        CHECK(result.attempts == first.attempts);
+    }
+    const auto again = (*cached_fight)(gerhard, Weapon::Stick);
+
+    CHECK(first.monster.name == gerhard.name);
+    CHECK(again.monster.name == gerhard.name);
+    CHECK(cached_fight->stats().hits == 2);
+}
+
+TEST_CASE("The fight cache works with user-defined monsters, from many threads")
+{
+    static constexpr auto trolls = make_monsters<300>([](int i) { return Troll{HealthPoints{100 + i}, 5}; });
+    static constexpr auto expected = fight_each_weapon(trolls, 10);
+    auto cached_fight = memoize_fight<Troll>();
+    int mismatches = 0;
+    std::mutex mutex;
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; ++t) {
+        threads.emplace_back([&, t] {
+            int local_mismatches = 0;
+            for (int i = 0; i < 20'000; ++i) {
+                const auto index = std::size_t(i * 7 + t) % trolls.size();
+                const auto weapon = weapons[i % 3];
+                const auto result = (*cached_fight)(trolls[index], weapon, 10);
+                const auto & fights = expected[std::size_t(weapon)];
+                local_mismatches += result.attempts != fights.attempts[index]
+                                 || !(result.monster == fights.monsters[index]);
+            }
+            const std::lock_guard lock(mutex);
+            mismatches += local_mismatches;
+        });
+    }
+    for (auto & thread : threads)
+        thread.join();
+
+    const auto stats = cached_fight->stats();
+    INFO("hit rate " << stats.hit_rate());
+    CHECK(mismatches == 0);
+    CHECK(stats.hits + stats.misses == 8 * 20'000);
+    CHECK(stats.hit_rate() > 0.9);
+}
+
+TEST_CASE("Fight cache against recomputing", "[!benchmark]")
+{
+    auto cached_fight = memoize_fight<Wolf>();
+    std::vector<Wolf> wolves;           // kept at runtime, so the compiler cannot fold the fights away
+    for (int health = 39'000; health < 39'100; ++health)
+        wolves.push_back(Wolf{"Wilhelm", HealthPoints{health}});
+
+    BENCHMARK("fight, 1000 attempts") {
+        int total = 0;
+        for (const auto & wolf : wolves)
+            total += fight(wolf, Weapon::Arrow, 1000).attempts;
+        return total;
+    };
+    BENCHMARK("memoized fight, 1000 attempts") {
+        int total = 0;
+        for (const auto & wolf : wolves)
+            total += (*cached_fight)(wolf, Weapon::Arrow, 1000).attempts;
+        return total;
+    };
+    WARN("hit rate " << cached_fight->stats().hit_rate());
+}
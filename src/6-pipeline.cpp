@@ -0,0 +1,577 @@
+/** Streaming fights
+ *
+ * So far, someone calls fight() and waits for the result. In production,
+ * hits arrive as a stream of commands instead: "monster 12 takes 40 from an
+ * arrow", and we must keep up with the stream.
+ *
+ * This example takes the runtime monsters from 4-variant.cpp and feeds them
+ * through a pipeline of threads:
+ *   1. a parser reads the stream in large chunks and cuts it into commands,
+ *   2. appliers hit the monsters. Each one owns a fixed subset of monsters,
+ *      so commands for a given monster are always applied in order,
+ *   3. an emitter writes deaths, and optionally comments, to an output stream.
+ *
+ * The only change to the monsters is that the damage part of hit() is split
+ * out into strike(), so that comments are not formatted when they are off.
+ *
+ * Stages are connected by bounded lock-free queues. When a stage falls behind,
+ * its input queue fills up and the stage before it waits: that is backpressure.
+ */
+
+#include <catch.hpp>
+#include <fmt/core.h>
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <variant>
+#include <vector>
+#include "health.h"
+#include "spsc_queue.h"
+#include "trace.h"
+using fmt::format;
+
+// ===========================================================================
+// Definitions
+
+using Name = std::string;
+using Comment = std::string;
+enum class Weapon { Stick, Arrow, Fireball };
+
+struct Wolf {
+    Name            name;
+    HealthPoints    health;
+};
+
+struct Firelord {
+    Name            name;
+    HealthPoints    health;
+};
+
+struct Ghost {};
+
+// ===========================================================================
+// Functions
+
+void strike(Wolf & wolf, Weapon, HealthPoints damage)
+{
+    wolf.health = max(HealthPoints{0}, wolf.health - damage);
+}
+
+void strike(Firelord & firelord, Weapon weapon, HealthPoints damage)
+{
+    switch (weapon) {
+    case Weapon::Stick:
+        firelord.health = max(HealthPoints{0}, firelord.health - damage / 2);
+        break;
+    case Weapon::Fireball:
+        break;
+    default:
+        firelord.health = max(HealthPoints{0}, firelord.health - damage);
+    }
+}
+
+void strike(Ghost &, Weapon, HealthPoints) {}
+
+Comment hit(Wolf & wolf, Weapon weapon, HealthPoints damage)
+{
+    TRACE_SCOPE("hit Wolf");
+    strike(wolf, weapon, damage);
+    return format("{} the wolf growls as it takes {} damage from the hit.", wolf.name, damage.value);
+}
+
+Comment hit(Firelord & firelord, Weapon weapon, HealthPoints damage)
+{
+    TRACE_SCOPE("hit Firelord");
+    strike(firelord, weapon, damage);
+    switch (weapon) {
+    case Weapon::Stick:
+        return format("{} the Firelord resists wooden stick and only takes {} damage.",
+            firelord.name, (damage / 2).value);
+    case Weapon::Fireball:
+        return format("{} the Firelord is immune to fireballs. He laughs at you.", firelord.name);
+    default:
+        return format("{} the Firelord roars {} damage from the hit.", firelord.name, damage.value);
+    }
+}
+
+Comment hit(Ghost&, Weapon, HealthPoints)
+{
+    TRACE_SCOPE("hit Ghost");
+    return "Ghosts are immortal. You are doomed.";
+}
+
+template <typename DefaultMonster>
+bool dead(const DefaultMonster & monster) { return !monster.health; }
+bool dead(const Ghost &) { return false; }
+
+using Monster = std::variant<Wolf, Firelord, Ghost>;
+
+Comment hit(Monster& monster, Weapon weapon, HealthPoints damage)
+{
+    TRACE_SCOPE("hit Monster");
+    return std::visit([&](auto & value) { return hit(value, weapon, damage); }, monster);
+}
+
+void strike(Monster& monster, Weapon weapon, HealthPoints damage)
+{
+    TRACE_SCOPE("strike Monster");
+    std::visit([&](auto & value) { strike(value, weapon, damage); }, monster);
+}
+
+bool dead(const Monster & monster) {
+    return std::visit([](const auto & value) { return dead(value); }, monster);
+}
+
+// ===========================================================================
+// Commands
+
+/* A command is one hit on one monster of the roster, identified by its index.
+ *
+ * Text streams have one command per line: "<id> <stick|arrow|fireball> <damage>".
+ * Binary streams are a sequence of records of three little-endian 32-bit
+ * integers: id, weapon, damage. Damage is never negative, that would heal.
+ */
+using MonsterId = std::uint32_t;
+
+struct Command {
+    MonsterId       monster;
+    Weapon          weapon;
+    HealthPoints    damage;
+};
+
+enum class StreamFormat { Text, Binary };
+
+namespace {
+    constexpr std::size_t binary_record_size = 12;
+
+    bool parse_weapon(std::string_view text, Weapon & weapon)
+    {
+        if (text == "stick") { weapon = Weapon::Stick; return true; }
+        if (text == "arrow") { weapon = Weapon::Arrow; return true; }
+        if (text == "fireball") { weapon = Weapon::Fireball; return true; }
+        return false;
+    }
+
+    std::string_view next_token(std::string_view & line)
+    {
+        const auto start = line.find_first_not_of(" \t\r");
+        if (start == std::string_view::npos) {
+            line = {};
+            return {};
+        }
+        line.remove_prefix(start);
+        const auto token = line.substr(0, line.find_first_of(" \t\r"));
+        line.remove_prefix(token.size());
+        return token;
+    }
+
+    template <typename Int>
+    bool parse_int(std::string_view text, Int & value)
+    {
+        const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+        return error == std::errc() && end == text.data() + text.size();
+    }
+
+    bool parse_text_command(std::string_view line, Command & command)
+    {
+        if (!parse_int(next_token(line), command.monster)
+            || !parse_weapon(next_token(line), command.weapon)
+            || !parse_int(next_token(line), command.damage.value)
+            || command.damage.value < 0)
+            return false;
+        return next_token(line).empty();
+    }
+
+    std::uint32_t read_le32(const char * bytes)
+    {
+        std::uint32_t value = 0;
+        for (int i = 3; i >= 0; --i)
+            value = (value << 8) | std::uint8_t(bytes[i]);
+        return value;
+    }
+
+    bool parse_binary_command(const char * record, Command & command)
+    {
+        const auto weapon = read_le32(record + 4);
+        const auto damage = read_le32(record + 8);
+        if (weapon > std::uint32_t(Weapon::Fireball) || damage > std::uint32_t(INT32_MAX))
+            return false;
+        command.monster = read_le32(record);
+        command.weapon = Weapon(weapon);
+        command.damage = HealthPoints{std::int32_t(damage)};
+        return true;
+    }
+}
+
+// Encodes commands the way the binary stream expects them.
+std::string encode_binary(const std::vector<Command> & commands)
+{
+    std::string bytes;
+    bytes.reserve(commands.size() * binary_record_size);
+    for (const auto & command : commands) {
+        for (const auto value : { command.monster, std::uint32_t(command.weapon),
+                                  std::uint32_t(command.damage.value) }) {
+            for (int i = 0; i < 4; ++i)
+                bytes.push_back(char((value >> (8 * i)) & 0xff));
+        }
+    }
+    return bytes;
+}
+
+// ===========================================================================
+// The pipeline
+
+struct PipelineOptions {
+    StreamFormat    format = StreamFormat::Text;
+    bool            comments = false;       // also emit the comment of every hit
+    unsigned        appliers = 0;           // 0 means one per spare core
+    std::size_t     chunk_size = 1 << 16;   // bytes read from the stream at once
+    std::size_t     batch_size = 1024;      // commands handed over at once
+};
+
+struct PipelineReport {
+    std::size_t                 commands = 0;
+    std::size_t                 rejected = 0;   // unparsable commands or unknown monsters
+    std::size_t                 deaths = 0;
+    std::size_t                 stalls = 0;     // times a stage waited on a full queue
+    std::chrono::nanoseconds    elapsed{};
+    std::chrono::nanoseconds    mean_latency{}; // from parsing a batch to emitting its events
+    std::chrono::nanoseconds    max_latency{};
+
+    double throughput() const           // commands per second
+    {
+        return elapsed.count() ? double(commands) * 1e9 / double(elapsed.count()) : 0.0;
+    }
+};
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+    constexpr std::size_t queue_capacity = 64;
+
+    struct CommandBatch {
+        std::vector<Command>    commands;
+        Clock::time_point       parsed;
+    };
+
+    struct Event {
+        MonsterId   monster;
+        bool        died;
+        Comment     comment;
+    };
+
+    struct EventBatch {
+        std::vector<Event>      events;
+        std::size_t             commands = 0;
+        Clock::time_point       parsed;
+    };
+
+    using CommandQueue = SpscQueue<CommandBatch, queue_capacity>;
+    using EventQueue = SpscQueue<EventBatch, queue_capacity>;
+
+    // Stage 1: cut the stream into batches, one batch per applier.
+    void parse_stage(std::istream & input, const PipelineOptions & options,
+                     std::vector<std::unique_ptr<CommandQueue>> & queues,
+                     std::size_t & rejected, std::size_t & stalls)
+    {
+        const auto shards = queues.size();
+        std::vector<CommandBatch> batches(shards);
+        auto dispatch = [&](const Command & command) {
+            auto & batch = batches[command.monster % shards];
+            if (batch.commands.empty())
+                batch.parsed = Clock::now();
+            batch.commands.push_back(command);
+            if (batch.commands.size() >= options.batch_size) {
+                stalls += queues[command.monster % shards]->push(std::move(batch));
+                batch = CommandBatch{};
+                batch.commands.reserve(options.batch_size);
+            }
+        };
+
+        std::string buffer;
+        std::vector<char> chunk(options.chunk_size);
+        for (;;) {
+            TRACE_SCOPE("parse chunk");
+            input.read(chunk.data(), std::streamsize(chunk.size()));
+            const auto got = std::size_t(input.gcount());
+            if (got == 0)
+                break;
+            buffer.append(chunk.data(), got);
+
+            std::size_t consumed = 0;
+            Command command;
+            if (options.format == StreamFormat::Binary) {
+                for (; buffer.size() - consumed >= binary_record_size; consumed += binary_record_size) {
+                    if (parse_binary_command(buffer.data() + consumed, command))
+                        dispatch(command);
+                    else
+                        ++rejected;
+                }
+            } else {
+                for (auto eol = buffer.find('\n'); eol != std::string::npos; eol = buffer.find('\n', consumed)) {
+                    const auto line = std::string_view(buffer).substr(consumed, eol - consumed);
+                    if (parse_text_command(line, command))
+                        dispatch(command);
+                    else if (line.find_first_not_of(" \t\r") != std::string_view::npos)
+                        ++rejected;
+                    consumed = eol + 1;
+                }
+            }
+            buffer.erase(0, consumed);
+        }
+
+        Command command;
+        if (options.format == StreamFormat::Binary) {
+            if (!buffer.empty())
+                ++rejected;         // truncated record
+        } else if (parse_text_command(buffer, command)) {
+            dispatch(command);      // last line without a newline
+        } else if (buffer.find_first_not_of(" \t\r\n") != std::string::npos) {
+            ++rejected;
+        }
+
+        for (std::size_t shard = 0; shard < shards; ++shard) {
+            if (!batches[shard].commands.empty())
+                stalls += queues[shard]->push(std::move(batches[shard]));
+            queues[shard]->close();
+        }
+    }
+
+    // Stage 2: apply a shard's commands. Only this thread touches its monsters.
+    void apply_stage(std::vector<Monster> & roster, bool comments,
+                     CommandQueue & input, EventQueue & output,
+                     std::size_t & rejected, std::size_t & stalls)
+    {
+        while (auto batch = input.pop()) {
+            TRACE_SCOPE("apply batch");
+            EventBatch events;
+            events.parsed = batch->parsed;
+            for (const auto & command : batch->commands) {
+                if (command.monster >= roster.size()) {
+                    ++rejected;
+                    continue;
+                }
+                ++events.commands;
+                auto & monster = roster[command.monster];
+                const bool was_dead = dead(monster);
+                if (comments) {
+                    auto comment = hit(monster, command.weapon, command.damage);
+                    events.events.push_back({ command.monster, !was_dead && dead(monster), std::move(comment) });
+                } else {
+                    strike(monster, command.weapon, command.damage);
+                    if (!was_dead && dead(monster))
+                        events.events.push_back({ command.monster, true, {} });
+                }
+            }
+            stalls += output.push(std::move(events));
+        }
+        output.close();
+    }
+
+    // Stage 3: write events and measure how long batches took to get through.
+    void emit_stage(std::ostream & output, std::vector<std::unique_ptr<EventQueue>> & queues,
+                    PipelineReport & report)
+    {
+        std::size_t batches = 0;
+        Clock::duration total_latency{};
+        EventBatch batch;
+        for (;;) {
+            bool idle = true, finished = true;
+            for (auto & queue : queues) {
+                if (queue->try_pop(batch)) {
+                    TRACE_SCOPE("emit batch");
+                    idle = false;
+                    for (const auto & event : batch.events) {
+                        if (!event.comment.empty())
+                            output <<event.monster <<": " <<event.comment <<'\n';
+                        if (event.died) {
+                            output <<event.monster <<": dies\n";
+                            ++report.deaths;
+                        }
+                    }
+                    const auto latency = Clock::now() - batch.parsed;
+                    report.commands += batch.commands;
+                    report.max_latency = std::max(report.max_latency,
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(latency));
+                    total_latency += latency;
+                    ++batches;
+                }
+                finished = finished && queue->finished();
+            }
+            if (finished)
+                break;
+            if (idle)
+                std::this_thread::yield();
+        }
+        if (batches)
+            report.mean_latency = std::chrono::duration_cast<std::chrono::nanoseconds>(total_latency) / batches;
+    }
+}
+
+/** Apply a whole command stream to the roster.
+ * Input can be any stream: a std::ifstream opened in binary mode, std::cin...
+ */
+PipelineReport run_pipeline(std::istream & input, std::ostream & output,
+                            std::vector<Monster> & roster, PipelineOptions options = {})
+{
+    if (options.appliers == 0) {
+        const auto cores = std::thread::hardware_concurrency();
+        options.appliers = cores > 3 ? cores - 2 : 1;
+    }
+    options.batch_size = std::max<std::size_t>(1, options.batch_size);
+    options.chunk_size = std::max<std::size_t>(binary_record_size, options.chunk_size);
+
+    std::vector<std::unique_ptr<CommandQueue>> commands;
+    std::vector<std::unique_ptr<EventQueue>> events;
+    for (unsigned i = 0; i < options.appliers; ++i) {
+        commands.push_back(std::make_unique<CommandQueue>());
+        events.push_back(std::make_unique<EventQueue>());
+    }
+
+    PipelineReport report;
+    std::vector<std::size_t> rejected(options.appliers + 1), stalls(options.appliers + 1);
+    const auto start = Clock::now();
+
+    std::vector<std::thread> stages;
+    stages.emplace_back([&] {
+        TRACE_THREAD();
+        parse_stage(input, options, commands, rejected[0], stalls[0]);
+    });
+    for (unsigned i = 0; i < options.appliers; ++i) {
+        stages.emplace_back([&, i] {
+            TRACE_THREAD();
+            apply_stage(roster, options.comments, *commands[i], *events[i], rejected[i + 1], stalls[i + 1]);
+        });
+    }
+    stages.emplace_back([&] {
+        TRACE_THREAD();
+        emit_stage(output, events, report);
+    });
+    for (auto & stage : stages)
+        stage.join();
+
+    report.elapsed = Clock::now() - start;
+    for (unsigned i = 0; i <= options.appliers; ++i) {
+        report.rejected += rejected[i];
+        report.stalls += stalls[i];
+    }
+    return report;
+}
+
+// ===========================================================================
+// Exercising the code
+
+namespace {
+    std::vector<Monster> make_roster()
+    {
+        return { Wolf{"Wilhelm", HealthPoints{100}},
+                 Firelord{"Gerhard", HealthPoints{100}},
+                 Ghost{} };
+    }
+}
+
+TEST_CASE("A text stream kills monsters in order") {
+    auto roster = make_roster();
+    auto input = std::istringstream(
+        "0 stick 40\n"
+        "1 fireball 40\n"
+        "0 arrow 40\n"
+        "1 stick 100\n"
+        "2 arrow 1000\n"
+        "0 arrow 40\n"
+        "1 arrow 50\n"
+        "0 arrow 40");                  // already dead, no newline at the end
+    auto output = std::ostringstream();
+
+    const auto report = run_pipeline(input, output, roster, { StreamFormat::Text, false, 2, 8, 2 });
+
+    CHECK(report.commands == 8);
+    CHECK(report.rejected == 0);
+    CHECK(report.deaths == 2);
+    CHECK(dead(roster[0]));
+    CHECK(dead(roster[1]));
+    CHECK(!dead(roster[2]));
+    CHECK(output.str().find("0: dies\n") != std::string::npos);
+    CHECK(output.str().find("1: dies\n") != std::string::npos);
+}
+
+TEST_CASE("Comments for the same monster come out in command order") {
+    auto roster = std::vector<Monster>{ Wolf{"Wilhelm", HealthPoints{1000}}, Wolf{"Wolfgang", HealthPoints{1000}} };
+    std::string stream;
+    for (int damage = 1; damage <= 200; ++damage)
+        stream += format("{} arrow {}\n", damage % 2, damage);
+    auto input = std::istringstream(stream);
+    auto output = std::ostringstream();
+
+    const auto report = run_pipeline(input, output, roster, { StreamFormat::Text, true, 2, 64, 3 });
+
+    CHECK(report.commands == 200);
+    auto lines = std::istringstream(output.str());
+    int last_damage[2] = { 0, 0 };
+    for (std::string line; std::getline(lines, line);) {
+        int id = 0, damage = 0;
+        if (std::sscanf(line.c_str(), "%d: %*s the wolf growls as it takes %d", &id, &damage) == 2) {
+            CHECK(damage > last_damage[id]);
+            last_damage[id] = damage;
+        }
+    }
+    CHECK(last_damage[0] == 200);
+    CHECK(last_damage[1] == 199);
+}
+
+TEST_CASE("Binary streams and bad commands") {
+    auto roster = make_roster();
+    auto input = std::istringstream(encode_binary({
+        { 0, Weapon::Arrow, HealthPoints{60} },
+        { 7, Weapon::Arrow, HealthPoints{60} },     // no such monster
+        { 1, Weapon::Arrow, HealthPoints{-60} },    // negative damage
+        { 0, Weapon::Arrow, HealthPoints{60} },
+    }) + "\n\n");                                   // truncated record, even if it looks blank
+    auto output = std::ostringstream();
+
+    const auto report = run_pipeline(input, output, roster, { StreamFormat::Binary, false, 1, 5, 1 });
+
+    CHECK(report.commands == 2);
+    CHECK(report.rejected == 3);
+    CHECK(report.deaths == 1);
+    CHECK(output.str() == "0: dies\n");
+    CHECK(std::get<Firelord>(roster[1]).health.value == 100);
+}
+
+TEST_CASE("Text commands cannot heal") {
+    auto roster = make_roster();
+    auto input = std::istringstream("0 arrow -60\n0 arrow 60\n0 stick -1");
+    auto output = std::ostringstream();
+
+    const auto report = run_pipeline(input, output, roster, { StreamFormat::Text, false, 1, 8, 1 });
+
+    CHECK(report.commands == 1);
+    CHECK(report.rejected == 2);
+    CHECK(std::get<Wolf>(roster[0]).health.value == 40);
+}
+
+TEST_CASE("Pipeline throughput", "[!benchmark]") {
+    std::vector<Monster> roster;
+    for (int i = 0; i < 10'000; ++i)
+        roster.push_back(Wolf{"Wilhelm", HealthPoints{1'000'000}});
+    std::string stream;
+    for (int i = 0; i < 1'000'000; ++i)
+        stream += format("{} arrow 1\n", i % 10'000);
+    auto input = std::istringstream(stream);
+    auto output = std::ostringstream();
+
+    const auto report = run_pipeline(input, output, roster);
+
+    CHECK(report.commands == 1'000'000);
+    WARN(format("{:.0f} commands/s, latency mean {} us, max {} us, {} stalls",
+                report.throughput(), report.mean_latency.count() / 1000,
+                report.max_latency.count() / 1000, report.stalls));
+}
@@ -0,0 +1,102 @@
+/** Replacement global allocation functions used by allocations.h
+ *
+ * This file is the `allocations` object library. Only executables linked
+ * against it get the counting operators, see CMakeLists.txt.
+ */
+#include "allocations.h"
+#include <cstdlib>
+#include <new>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+namespace {
+    thread_local AllocationStats counters{};
+
+    void * allocate(std::size_t size)
+    {
+        ++counters.allocations;
+        counters.bytes += size;
+        for (;;) {
+            if (auto ptr = std::malloc(size ? size : 1))
+                return ptr;
+            if (auto handler = std::get_new_handler())
+                handler();
+            else
+                throw std::bad_alloc();
+        }
+    }
+
+    void * allocate(std::size_t size, std::align_val_t align)
+    {
+        ++counters.allocations;
+        counters.bytes += size;
+        const auto alignment = static_cast<std::size_t>(align);
+        const auto rounded = (size + alignment - 1) / alignment * alignment;
+        for (;;) {
+#ifdef _WIN32
+            auto ptr = _aligned_malloc(rounded ? rounded : alignment, alignment);
+#else
+            auto ptr = std::aligned_alloc(alignment, rounded ? rounded : alignment);
+#endif
+            if (ptr)
+                return ptr;
+            if (auto handler = std::get_new_handler())
+                handler();
+            else
+                throw std::bad_alloc();
+        }
+    }
+
+    void deallocate(void * ptr) noexcept
+    {
+        if (!ptr)
+            return;
+        ++counters.deallocations;
+        std::free(ptr);
+    }
+
+    void deallocate(void * ptr, std::align_val_t) noexcept
+    {
+        if (!ptr)
+            return;
+        ++counters.deallocations;
+#ifdef _WIN32
+        _aligned_free(ptr);
+#else
+        std::free(ptr);
+#endif
+    }
+}
+
+AllocationStats thread_allocations() { return counters; }
+
+// ===========================================================================
+// Replacement functions. The array, sized and nothrow forms are not strictly
+// required, but defining them all keeps us independent of how the standard
+// library implements its defaults.
+
+void * operator new(std::size_t size) { return allocate(size); }
+void * operator new[](std::size_t size) { return allocate(size); }
+void * operator new(std::size_t size, std::align_val_t align) { return allocate(size, align); }
+void * operator new[](std::size_t size, std::align_val_t align) { return allocate(size, align); }
+
+void * operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+    try { return allocate(size); } catch (...) { return nullptr; }
+}
+void * operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+    try { return allocate(size); } catch (...) { return nullptr; }
+}
+
+void operator delete(void * ptr) noexcept { deallocate(ptr); }
+void operator delete[](void * ptr) noexcept { deallocate(ptr); }
+void operator delete(void * ptr, std::size_t) noexcept { deallocate(ptr); }
+void operator delete[](void * ptr, std::size_t) noexcept { deallocate(ptr); }
+void operator delete(void * ptr, std::align_val_t align) noexcept { deallocate(ptr, align); }
+void operator delete[](void * ptr, std::align_val_t align) noexcept { deallocate(ptr, align); }
+void operator delete(void * ptr, std::size_t, std::align_val_t align) noexcept { deallocate(ptr, align); }
+void operator delete[](void * ptr, std::size_t, std::align_val_t align) noexcept { deallocate(ptr, align); }
+void operator delete(void * ptr, const std::nothrow_t &) noexcept { deallocate(ptr); }
+void operator delete[](void * ptr, const std::nothrow_t &) noexcept { deallocate(ptr); }
@@ -1,2 +1,10 @@
 #define CATCH_CONFIG_MAIN  
 #include "catch.hpp"
+#include "trace.h"
+
+// Gives the main thread its trace buffer before any test, so that tests do not measure it.
+struct TraceMainThread : Catch::TestEventListenerBase {
+    using TestEventListenerBase::TestEventListenerBase;
+    void testRunStarting(const Catch::TestRunInfo &) override { TRACE_THREAD(); }
+};
+CATCH_REGISTER_LISTENER(TraceMainThread)
@@ -0,0 +1,79 @@
+/** Tests for trace.h
+ *
+ * Recording and export work whether or not POLY_TRACING is defined: only the
+ * TRACE_SCOPE and TRACE_THREAD macros are compiled out, so these tests call
+ * trace::Scope and trace::register_thread directly.
+ */
+
+#include <catch.hpp>
+#include <fmt/core.h>
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <thread>
+#include "trace.h"
+using fmt::format;
+
+TEST_CASE("Trace events come out as Chrome trace-event JSON") {
+    trace::register_thread();
+    trace::clear();
+    auto worker = std::thread([] {
+        trace::register_thread();
+        const trace::Scope scope("apply batch");
+    });
+    {
+        const trace::Scope scope("parse chunk");
+        worker.join();
+    }
+    auto output = std::ostringstream();
+
+    trace::write_chrome_json(output);
+
+    const auto json = output.str();
+    CHECK(json.rfind("{\"traceEvents\":[", 0) == 0);
+    CHECK(json.find(R"({"name":"parse chunk","ph":"X","pid":1,)") != std::string::npos);
+    CHECK(json.find(R"({"name":"apply batch","ph":"X","pid":1,)") != std::string::npos);
+    CHECK(trace::dropped() == 0);
+}
+
+TEST_CASE("Threads that exited leave their trace buffer to the next ones") {
+    trace::clear();
+    for (const auto name : { "first", "second" }) {
+        std::thread([name] {
+            trace::register_thread();
+            const trace::Scope scope(name);
+        }).join();
+    }
+    auto output = std::ostringstream();
+
+    trace::write_chrome_json(output);
+
+    const auto json = output.str();
+    auto thread_of = [&json](const std::string & name) {
+        const auto event = json.find(R"({"name":")" + name + '"');
+        const auto tid = json.find(R"("tid":)", event);
+        return event == std::string::npos ? std::string() : json.substr(tid, json.find(',', tid) - tid);
+    };
+    CHECK(!thread_of("first").empty());
+    CHECK(thread_of("first") == thread_of("second"));
+}
+
+// The budget for one traced scope, both timestamps and the stores included.
+// Recording does not meet it yet, hence [!mayfail].
+TEST_CASE("Tracing overhead", "[!benchmark][!mayfail]") {
+    constexpr int events = 50'000;
+    constexpr auto budget = std::chrono::nanoseconds(20);
+    trace::register_thread();
+    trace::clear();
+
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < events; ++i)
+        const trace::Scope scope("bench");
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+
+    const auto per_scope = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed) / events;
+    CHECK(trace::dropped() == 0);
+    INFO(format("{} ns per traced scope", per_scope.count()));
+    CHECK(per_scope <= budget);   // not met yet: about 50 ns in a release build on x86-64
+    trace::clear();
+}
@@ -0,0 +1,136 @@
+/** Thread buffer registry and exporter for trace.h
+ *
+ * Buffers are created when a thread registers, and kept until the program
+ * exits so that events of finished threads can still be written out. When a
+ * thread exits, its buffer goes to a free list for the next thread to register.
+ */
+#include "trace.h"
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace trace {
+    namespace {
+        using Clock = std::chrono::steady_clock;
+
+        struct Registry {
+            std::mutex                                  mutex;
+            std::vector<std::unique_ptr<ThreadBuffer>>  buffers;
+            std::vector<ThreadBuffer *>                 free;       // left by exited threads
+            // Reference point to convert raw timestamps to wall time.
+            std::uint64_t                               origin_ticks = now();
+            Clock::time_point                           origin_time = Clock::now();
+        };
+
+        // Never destroyed: the main thread may give its buffer back after
+        // static objects are gone, while the program exits.
+        Registry & registry()
+        {
+            static auto instance = new Registry;
+            return *instance;
+        }
+
+        // Gives the buffer back when its thread exits.
+        struct Registration {
+            ~Registration()
+            {
+                if (!thread_buffer)
+                    return;
+                auto & reg = registry();
+                const std::lock_guard lock(reg.mutex);
+                reg.free.push_back(thread_buffer);
+                thread_buffer = nullptr;
+            }
+        };
+
+        // Raw timestamp units per microsecond.
+        double ticks_per_microsecond(const Registry & reg)
+        {
+#ifdef POLY_TRACE_TSC
+            auto elapsed = Clock::now() - reg.origin_time;
+            if (elapsed < std::chrono::milliseconds(10)) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10) - elapsed);
+                elapsed = Clock::now() - reg.origin_time;
+            }
+            const auto ticks = now() - reg.origin_ticks;
+            return double(ticks) / std::chrono::duration<double, std::micro>(elapsed).count();
+#else
+            (void)reg;
+            return 1000.0;
+#endif
+        }
+    }
+
+    void register_thread()
+    {
+        thread_local Registration registration;
+        if (thread_buffer)
+            return;
+
+        auto & reg = registry();
+        std::unique_lock lock(reg.mutex);
+        if (!reg.free.empty()) {
+            thread_buffer = reg.free.back();
+            reg.free.pop_back();
+            return;
+        }
+        lock.unlock();
+        auto buffer = std::make_unique<ThreadBuffer>();
+        lock.lock();
+        buffer->thread_id = std::uint32_t(reg.buffers.size() + 1);
+        reg.buffers.push_back(std::move(buffer));
+        thread_buffer = reg.buffers.back().get();
+    }
+
+    void write_chrome_json(std::ostream & output)
+    {
+        auto & reg = registry();
+        const std::lock_guard lock(reg.mutex);
+        const auto scale = ticks_per_microsecond(reg);
+
+        const auto flags = output.flags();
+        const auto precision = output.precision();
+        output <<std::fixed <<std::setprecision(3) <<"{\"traceEvents\":[";
+        const char * separator = "\n";
+        for (const auto & buffer : reg.buffers) {
+            const auto size = buffer->size.load(std::memory_order_acquire);
+            for (std::size_t i = 0; i < size; ++i) {
+                const auto & event = buffer->events[i];
+                // Signed: the very first event may start before the registry existed.
+                const auto begin = double(std::int64_t(event.begin - reg.origin_ticks)) / scale;
+                const auto duration = double(event.end - event.begin) / scale;
+                output <<separator
+                       <<R"({"name":")" <<event.name
+                       <<R"(","ph":"X","pid":1,"tid":)" <<buffer->thread_id
+                       <<R"(,"ts":)" <<begin <<R"(,"dur":)" <<duration <<'}';
+                separator = ",\n";
+            }
+        }
+        output <<"\n],\"displayTimeUnit\":\"ns\"}\n";
+        output.flags(flags);
+        output.precision(precision);
+    }
+
+    void clear()
+    {
+        auto & reg = registry();
+        const std::lock_guard lock(reg.mutex);
+        for (auto & buffer : reg.buffers) {
+            buffer->size.store(0, std::memory_order_relaxed);
+            buffer->dropped.store(0, std::memory_order_relaxed);
+        }
+        unregistered.store(0, std::memory_order_relaxed);
+    }
+
+    std::size_t dropped()
+    {
+        auto & reg = registry();
+        const std::lock_guard lock(reg.mutex);
+        std::size_t total = unregistered.load(std::memory_order_relaxed);
+        for (const auto & buffer : reg.buffers)
+            total += buffer->dropped.load(std::memory_order_relaxed);
+        return total;
+    }
+}